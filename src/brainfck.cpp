@@ -1,10 +1,51 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
 #include <iterator>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <set>
 #include <stack>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include <dirent.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <linux/perf_event.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
 namespace brainfck
 {
 
@@ -28,243 +69,6484 @@ read_until (std::istream &input, std::ostream &output, char target)
   return buf.size ();
 }
 
+/// Reads the whole file at @a path into @a data.
+/// @throw std::runtime_error if the file can't be read.
+static void
+read_file (const std::string &path, std::string *data)
+{
+  std::ifstream file (path, std::ios::in | std::ios::binary);
+  if (!file)
+    throw std::runtime_error ("unable to open " + path);
+
+  data->assign (
+    std::istreambuf_iterator <char> (file), std::istreambuf_iterator <char> ()
+  );
+  if (file.bad ())
+    throw std::runtime_error ("unable to read " + path);
+}
+
+/// Reads everything up to the end of @a fd into @a data, in large chunks.
+/// @throw std::runtime_error if reading fails.
+static void
+read_all (int fd, std::string *data)
+{
+  data->clear ();
+  size_t size = 0;
+  for (;;)
+  {
+    if (data->size () - size < 65536)
+      data->resize (std::max <size_t> (2 * data->size (), size + 65536));
+
+    const ssize_t n = read (fd, &(*data)[size], data->size () - size);
+    if (n < 0 && EINTR == errno)
+      continue;
+    if (n < 0)
+      throw std::runtime_error ("unable to read input");
+    if (!n)
+      break;
+
+    size += n;
+  }
+
+  data->resize (size);
+}
+
 namespace
 {
 
-class context_t
+/// Bump allocator for the data structures built while compiling a program.
+/// Allocating bumps a pointer within the current block, freeing does nothing,
+/// and reset () releases everything at once. Blocks are kept across resets,
+/// so an arena reused job after job soon stops calling the global allocator.
+/// @note Not thread safe; give each thread its own.
+class arena_t
 {
 public:
-  typedef std::vector <char> code_container_t;
-  typedef code_container_t::iterator code_iterator_t;
+  explicit arena_t (size_t block_size = 1 << 16);
 
-  /// Constructor.
-  context_t ();
+  ~arena_t ();
 
-  /// Executes BF code.
-  /// @throw std::runtime_error if the maximum number of operations is
-  /// exceeded, or if a bracket mismatch is detected.
-  size_t
-  execute (
-    code_iterator_t code_begin, code_iterator_t code_end, std::istream &input,
-    std::ostream &out
-  );
+  /// @throw std::bad_alloc
+  void *
+  allocate (size_t size, size_t alignment);
 
-  /// Sets the maximum number of operations, and returns the old value.
-  size_t
-  set_max_operations (size_t max_operations);
+  /// Releases every allocation, keeping the memory for reuse.
+  void
+  reset ();
 
 private:
-  typedef std::vector <unsigned char> slot_container_t;
-  typedef std::stack <code_iterator_t> stash_container_t;
+  struct block_t
+  {
+    char *data;
+    size_t size;
+  };
 
-  void
-  increment ();
+  size_t block_size_;
+  std::vector <block_t> blocks_;
 
-  void
-  decrement ();
+  /// Block being allocated from, and the free space left in it.
+  size_t current_;
+  char *next_;
+  char *end_;
 
-  /// @throw std::underflow_error
-  void
-  prev_slot ();
+  arena_t (const arena_t &) = delete;
+  arena_t & operator = (const arena_t &) = delete;
+};
 
-  void
-  next_slot ();
+/// Standard allocator drawing from an arena, or from the global heap when
+/// given none, so containers can be pointed at an arena without changing
+/// type.
+template <typename T>
+class arena_allocator_t
+{
+public:
+  typedef T value_type;
 
-  void
-  send_out (std::ostream &out);
+  arena_allocator_t (arena_t *arena = nullptr) noexcept : arena_ (arena) {}
 
-  void
-  read_in (std::istream &input);
+  template <typename U>
+  arena_allocator_t (const arena_allocator_t <U> &other) noexcept
+  : arena_ (other.arena ())
+  {
+  }
 
-  /// @throw std::runtime_error on bracket mismatch
-  void
-  start_loop (
-    code_iterator_t *it, code_iterator_t code_end, stash_container_t *stash
-  );
+  T *
+  allocate (size_t n)
+  {
+    if (!arena_)
+      return std::allocator <T> ().allocate (n);
+    return static_cast <T *> (arena_->allocate (n * sizeof (T), alignof (T)));
+  }
 
-  /// @throw std::runtime_error on bracket mismatch
   void
-  end_loop (code_iterator_t *it, stash_container_t *stash);
-
-  /**/
+  deallocate (T *p, size_t n) noexcept
+  {
+    if (!arena_)
+      std::allocator <T> ().deallocate (p, n);
+  }
 
-  slot_container_t slots_;
-  slot_container_t::iterator slot_;
-  size_t operation_count_max_;
-  size_t operation_count_;
+  arena_t *
+  arena () const { return arena_; }
 
-  context_t (const context_t &) = delete;
-  context_t & operator = (const context_t &) = delete;
+private:
+  arena_t *arena_;
 };
 
-} // anonymous namespace
+template <typename T, typename U>
+bool
+operator == (const arena_allocator_t <T> &a, const arena_allocator_t <U> &b)
+{
+  return a.arena () == b.arena ();
+}
 
-context_t::context_t ()
-: slots_               (1, 0),
-  slot_                (begin (slots_)),
-  operation_count_max_ (DEFAULT_MAX_OPERATIONS),
-  operation_count_     (0)
+template <typename T, typename U>
+bool
+operator != (const arena_allocator_t <T> &a, const arena_allocator_t <U> &b)
 {
+  return !(a == b);
 }
 
-size_t
-context_t::execute (
-  code_iterator_t code_begin, code_iterator_t code_end, std::istream &input,
-  std::ostream &out )
+/// Patched over an instruction in a debugger's copy of a program, to stop
+/// execution before it.
+static const char BREAK_OP = '#';
+
+/// A single compiled operation.
+struct instruction_t
 {
-  size_t operation_count_start = operation_count_;
-  stash_container_t stash;
-  for (auto cp = code_begin; cp != code_end; ++cp)
+  /// One of the eight BF commands, or BREAK_OP.
+  char op;
+
+  /// For '[' and ']', the index of the matching bracket.
+  size_t jump;
+
+  /// Offset of the command in the source code.
+  size_t position;
+};
+
+/// Fused ops standing for a whole loop whose trip count the counter (the
+/// cell it tests) gives on entry: the body runs that many times without
+/// tests or limit checks, or once with its additions scaled, if it doesn't
+/// output. Even when it does, the cells no output reads are changed once.
+static const char REPEAT_OP = 'r';
+static const char SCALE_OP = 's';
+
+/// An instruction of a program's optimized form, standing for a run of its
+/// instructions.
+struct fused_t
+{
+  /// '+' adds to a cell, '>' moves the pointer, '.' and ',' output and
+  /// input a cell, '[' and ']' test the cell under the pointer; or a
+  /// REPEAT_OP or SCALE_OP.
+  char op;
+
+  /// For '+' the value added, for '>' the distance moved. For loops, the
+  /// inverse (mod 256) of the counter's step, which turns the counter into
+  /// the trip count.
+  ptrdiff_t arg;
+
+  /// The cell operated on, relative to the pointer. For a REPEAT_OP, the
+  /// number of ops of the body run on every trip; the rest are run once,
+  /// with additions multiplied by the trip count.
+  ptrdiff_t offset;
+
+  /// For brackets, the index of the matching one. For loops, and the first
+  /// op of a basic block, the index past the ops they stand for with it,
+  /// which follow unchecked.
+  size_t jump;
+
+  /// Operations of the instructions fused, per iteration for loops. Ops
+  /// following the first of a block or a loop carry none.
+  size_t cost;
+
+  /// Index of the first instruction fused.
+  size_t origin;
+
+  /// Lowest slot reached, relative to the pointer before the op.
+  ptrdiff_t low;
+};
+
+typedef std::vector <fused_t, arena_allocator_t <fused_t>> fused_code_t;
+
+/// The optimizer's view of a program, which its optimized form is lowered
+/// from. Loops make up a nesting tree, the body of each (and the program
+/// itself) a sequence of loops and basic blocks: the code between two
+/// brackets, which moves the pointer by a fixed distance. The cells of a
+/// block are value numbered: each holds a value it had on entry to the
+/// block, or read from input in it, plus a constant.
+class ir_t
+{
+public:
+  /// Builds the representation of @a size @a instructions, whose brackets
+  /// are resolved, allocating from @a arena if given; it mustn't outlive it.
+  ir_t (
+    const instruction_t *instructions, size_t size, arena_t *arena = nullptr
+  );
+
+  /// Appends the optimized form of the program to @a code.
+  void
+  lower (fused_code_t *code) const;
+
+private:
+  static const size_t NONE = -1;
+
+  struct value_t
   {
-    if (++operation_count_ > operation_count_max_)
-      throw std::runtime_error ("max operations exceeded");
+    size_t number;
+    unsigned char addend;
+  };
 
-    switch (*cp)
+  /// Values of cells, by offset.
+  typedef std::map <
+    ptrdiff_t, value_t, std::less <ptrdiff_t>,
+    arena_allocator_t <std::pair <const ptrdiff_t, value_t>>
+  > value_map_t;
+
+  /// An output or input, in program order.
+  struct effect_t
+  {
+    char op;
+    ptrdiff_t offset;
+
+    /// The value in the cell beforehand.
+    value_t value;
+
+    /// For input, the number of the value read (which is the value before
+    /// at the end of the input).
+    size_t result;
+  };
+
+  struct block_t
+  {
+    explicit block_t (arena_t *arena)
+    : effects (arena), entry (arena), exit (arena)
     {
-    case '+': increment (); break;
-    case '-': decrement (); break;
-    case '<': prev_slot (); break;
-    case '>': next_slot (); break;
-    case '.': send_out (out); break;
-    case ',': read_in (input); break;
-    case '[': start_loop (&cp, code_end, &stash); break;
-    case ']': end_loop (&cp, &stash); break;
     }
-  }
 
-  return operation_count_ - operation_count_start;
-}
+    /// Instruction range.
+    size_t first, last;
 
-size_t
-context_t::set_max_operations (size_t max_operations)
-{
-  std::swap (operation_count_max_, max_operations);
-  return max_operations;
-}
+    ptrdiff_t move;
 
-void
-context_t::increment ()
-{
-  ++*slot_;
-}
+    /// Lowest slot the pointer reaches, relative to the entry.
+    ptrdiff_t low;
 
-void
-context_t::decrement () {
-  --*slot_;
-}
+    std::vector <effect_t, arena_allocator_t <effect_t>> effects;
 
-void
-context_t::prev_slot ()
-{
-  if (slot_ == begin (slots_))
-    throw std::underflow_error ("slot underflow");
-  --slot_;
-}
+    /// Values on entry of the cells used, by offset.
+    std::map <
+      ptrdiff_t, size_t, std::less <ptrdiff_t>,
+      arena_allocator_t <std::pair <const ptrdiff_t, size_t>>
+    > entry;
 
-void
-context_t::next_slot ()
-{
-  if (next (slot_) == end (slots_))
+    /// Values on exit of the cells changed.
+    value_map_t exit;
+  };
+
+  struct node_t
   {
-    slots_.push_back (0);
-    slot_ = prev (end (slots_));
-  }
-  else
+    bool loop;
+
+    /// Index into loops_ or blocks_.
+    size_t index;
+  };
+
+  typedef std::vector <node_t, arena_allocator_t <node_t>> node_container_t;
+
+  struct loop_t
   {
-    ++slot_;
-  }
-}
+    loop_t (size_t open, size_t close, size_t parent, arena_t *arena)
+    : open (open), close (close), parent (parent), body (arena),
+      advancing (false)
+    {
+    }
 
-void
-context_t::send_out (std::ostream &out)
-{
-  out << *slot_;
-}
+    /// Instruction indices of the brackets.
+    size_t open, close;
 
-void
-context_t::read_in (std::istream &input)
+    /// Enclosing loop, or NONE.
+    size_t parent;
+
+    node_container_t body;
+
+    /// Whether no trip can leave the pointer lower than it found it.
+    bool advancing;
+  };
+
+  /// Scans [@a first, @a last) of the instructions into a new block.
+  void
+  scan (const instruction_t *instructions, size_t first, size_t last);
+
+  /// Appends the optimized form of @a nodes to @a code. @a floor is the
+  /// lowest slot the pointer can be at on entry, which spares the checks
+  /// for leaving the tape of what can't; it's updated for the exit.
+  void
+  lower (
+    const node_container_t &nodes, fused_code_t *code, size_t *floor
+  ) const;
+
+  /// Appends the ops carrying out @a block to @a code, unchecked. Changes
+  /// to cells none of its effects read come last.
+  /// @return The number of those.
+  size_t
+  lower_block (const block_t &block, fused_code_t *code) const;
+
+  /// @return Whether @a loop is a single block running a fixed number of
+  /// times, which it sets @a block to.
+  bool
+  fixed (const loop_t &loop, const block_t **block) const;
+
+  arena_t *arena_;
+  node_container_t program_;
+  std::vector <loop_t, arena_allocator_t <loop_t>> loops_;
+  std::vector <block_t, arena_allocator_t <block_t>> blocks_;
+};
+
+/// BF code stripped of comments, with brackets resolved ahead of time.
+/// Immutable once constructed, so a single program may be shared by any
+/// number of contexts (and threads).
+///
+/// Alongside the instructions, the program keeps an optimized form, where
+/// runs of them are fused into single ops carrying their operation count.
+class program_t
 {
-  if (EOF != input.peek ())
-    *slot_ = input.get ();
-}
+public:
+  typedef std::vector <instruction_t, arena_allocator_t <instruction_t>>
+    instruction_container_t;
+  typedef instruction_container_t::const_iterator const_iterator;
+  typedef fused_code_t fused_container_t;
 
-void
-context_t::start_loop (
-  code_iterator_t *it, code_iterator_t code_end, stash_container_t *stash )
+  /// Compiles the BF code in [@a code_begin, @a code_end), allocating from
+  /// @a arena if given; the program mustn't outlive it.
+  /// @throw std::runtime_error if a bracket mismatch is detected.
+  template <typename iterator_t>
+  program_t (
+    iterator_t code_begin, iterator_t code_end, arena_t *arena = nullptr
+  );
+
+  /// Takes the @a size @a instructions and @a fused_size @a fused ops of a
+  /// program compiled before, as is.
+  program_t (
+    const instruction_t *instructions, size_t size, const fused_t *fused,
+    size_t fused_size
+  );
+
+  const_iterator
+  begin () const { return std::begin (instructions_); }
+
+  const_iterator
+  end () const { return std::end (instructions_); }
+
+  size_t
+  size () const { return instructions_.size (); }
+
+  /// @return The optimized form.
+  const fused_container_t &
+  fused () const { return fused_; }
+
+  /// Lists in @a entries, for each instruction, the fused op on which the
+  /// optimized form can take over from it, in the state the instruction
+  /// would run in, or SIZE_MAX if there is none.
+  void
+  fused_entries (std::vector <size_t> *entries) const;
+
+  /// Replaces the op of instruction @a index. Only meant for a debugger's
+  /// private copy, which no other context may be running meanwhile; the
+  /// optimized form isn't patched.
+  void
+  patch (size_t index, char op) { instructions_[index].op = op; }
+
+private:
+  /// Builds the optimized form from the instructions.
+  void
+  fuse ();
+
+  instruction_container_t instructions_;
+  fused_container_t fused_;
+};
+
+/// Splits a program's top level into segments that can run concurrently,
+/// each on its own tape, with their outputs stitched back together in order.
+///
+/// A segment is independent of the ones before it when it reads no cell they
+/// write; the pointer must move statically (every loop balanced) so that
+/// cells have known absolute positions, and the program must not read input.
+/// Clearing a cell (`[-]` or `[+]`) doesn't read it, though the loop's cost
+/// depends on the value left behind, so those are recorded to correct the
+/// operation count once the real values are known.
+class segment_plan_t
 {
-  if (*slot_)
+public:
+  struct clear_t
   {
-    stash->push (*it);
-    return;
-  }
-  while (++*it != code_end)
+    ptrdiff_t slot;
+    char op;
+  };
+
+  typedef std::set <
+    ptrdiff_t, std::less <ptrdiff_t>, arena_allocator_t <ptrdiff_t>
+  > slot_set_t;
+
+  struct segment_t
   {
-    if (']' == **it)
-      return;
-  }
+    explicit segment_t (arena_t *arena)
+    : reads (arena), writes (arena), clears (arena)
+    {
+    }
 
-  throw std::runtime_error ("bracket mismatch (no closing)");
-}
+    /// Instruction range of the segment.
+    size_t first, last;
 
-void
-context_t::end_loop (code_iterator_t *it, stash_container_t *stash)
-{
-  if (stash->empty ())
-    throw std::runtime_error ("bracket mismatch (no opening)");
+    /// Absolute slot the segment starts on.
+    ptrdiff_t entry;
 
-  if (*slot_)
-    *it = stash->top ();
-  else
-    stash->pop ();
-}
+    /// Highest absolute slot touched.
+    ptrdiff_t high;
 
-static int
-main ()
+    /// Slots whose initial value the segment depends on.
+    slot_set_t reads;
+
+    /// Slots the segment may modify.
+    slot_set_t writes;
+
+    /// Loops clearing a slot before anything else in the segment touches it.
+    std::vector <clear_t, arena_allocator_t <clear_t>> clears;
+
+    /// Loops other than clears, a rough measure of the segment's cost.
+    size_t loops;
+  };
+
+  typedef std::vector <segment_t, arena_allocator_t <segment_t>>
+    segment_container_t;
+
+  /// Plans @a program, allocating from @a arena if given; the plan mustn't
+  /// outlive it.
+  explicit segment_plan_t (
+    const program_t &program, arena_t *arena = nullptr
+  );
+
+  /// Whether there is more than one segment to run.
+  bool
+  parallel () const { return segments_.size () > 1; }
+
+  const segment_container_t &
+  segments () const { return segments_; }
+
+  /// Absolute slot the program finishes on.
+  ptrdiff_t
+  exit () const { return exit_; }
+
+private:
+  /// Records the footprint of the loop at @a ip into @a segment.
+  /// @return false if the loop isn't balanced or reads input.
+  bool
+  trace_loop (
+    program_t::const_iterator code_begin, program_t::const_iterator ip,
+    ptrdiff_t slot, segment_t *segment
+  );
+
+  /// Folds @a segment into the last segment of the plan.
+  void
+  merge (segment_t *segment);
+
+  arena_t *arena_;
+  segment_container_t segments_;
+  ptrdiff_t exit_;
+
+  /// For each slot written so far, the first segment writing it.
+  std::map <
+    ptrdiff_t, size_t, std::less <ptrdiff_t>,
+    arena_allocator_t <std::pair <const ptrdiff_t, size_t>>
+  > writer_;
+};
+
+/// Conservative static bounds on the cost of running a program: operations
+/// executed and tape cells used, before reading any of its input.
+///
+/// Cells are followed abstractly, as known values or unknown, and loops
+/// bounded when their counter (the cell they test) changes by a constant on
+/// every iteration: exactly from a known value, and within 255 iterations
+/// from an unknown one when the step is odd. A loop whose body always leaves
+/// its counter at 0 runs at most once. Loops that move the pointer, counters
+/// changed any other way, and programs too large to analyze cheaply are
+/// unbounded.
+class cost_estimate_t
 {
-  size_t input_count, line_count;
-  std::cin >> input_count >> line_count >> std::ws;
+public:
+  /// Stands for a cost that couldn't be bounded.
+  static const size_t UNBOUNDED = SIZE_MAX;
 
-  std::stringstream input;
-  size_t actual_input = read_until (std::cin, input, '$');
-  if (actual_input != input_count)
-  {
-    std::cerr << "Invalid input, expected " << input_count << " characters, "
-      << "received " << actual_input << std::endl;
-    return 1;
-  }
+  /// Analyzes @a program, allocating from @a arena if given.
+  explicit cost_estimate_t (
+    const program_t &program, arena_t *arena = nullptr
+  );
+
+  /// @return An upper bound on the operations executed, or UNBOUNDED.
+  size_t
+  operations () const { return operations_; }
 
-  std::cin >> std::ws;
+  /// @return An upper bound on the tape cells used, or UNBOUNDED.
+  size_t
+  tape () const { return tape_; }
 
-  size_t lines = 0;
-  std::vector <char> code;
-  for (size_t i = 0; i < line_count; ++i)
-  {
-    std::string line;
-    if (!getline (std::cin, line))
-      break;
+private:
+  /// Values of the cells written so far, by slot; UNKNOWN when they depend
+  /// on input or the analysis lost track. Slots not in the map hold 0.
+  typedef std::map <
+    ptrdiff_t, int, std::less <ptrdiff_t>,
+    arena_allocator_t <std::pair <const ptrdiff_t, int>>
+  > cells_t;
 
-    std::copy (begin (line), end (line), std::back_inserter (code));
-    ++lines;
-  }
+  static const int UNKNOWN = -1;
 
-  if (lines != line_count)
-  {
-    std::cerr << "Expected " << line_count << " lines, received " << lines
-      << std::endl;
-    return 1;
-  }
+  /// Abstract steps after which the analysis gives up.
+  static const size_t STEP_LIMIT = 1 << 20;
 
-  context_t c;
-  (void) c.execute (begin (code), end (code), input, std::cout);
+  /// Follows the instructions in [@a first, @a last) from @a slot, updating
+  /// it and @a cells.
+  /// @return An upper bound on the operations executed, or UNBOUNDED.
+  size_t
+  walk (
+    program_t::const_iterator first, program_t::const_iterator last,
+    ptrdiff_t *slot, cells_t *cells
+  );
+
+  /// Follows the loop at @a ip, entered on @a slot, updating @a cells.
+  /// @return An upper bound on the operations executed, or UNBOUNDED.
+  size_t
+  loop (program_t::const_iterator ip, ptrdiff_t slot, cells_t *cells);
+
+  arena_t *arena_;
+  program_t::const_iterator code_begin_;
+
+  /// Set once the pointer can't be followed, or the analysis ran too long.
+  bool gave_up_;
+
+  size_t steps_;
+  ptrdiff_t high_;
+  size_t operations_;
+  size_t tape_;
+};
+
+/// Observes every instruction as it executes. This one does nothing, and
+/// compiles away entirely.
+struct null_probe_t
+{
+  void
+  step (const instruction_t &) {}
+};
+
+/// Statistical profiler. SIGPROF fires every interval of CPU time, and the
+/// handler records which instruction the interpreter is on into a fixed
+/// buffer, without locks or allocation. Samples are folded into one stack per
+/// instruction, the enclosing loops playing the part of callers, for flame
+/// graph tools. Loops are named after the source range they span, e.g.
+/// `[12-40]`.
+/// @note Only one sampler may be running at a time.
+class sampler_t
+{
+public:
+  explicit sampler_t (size_t capacity = 1 << 20);
+
+  ~sampler_t ();
+
+  /// Starts sampling every @a interval of CPU time.
+  /// @throw std::runtime_error if the timer can't be set up.
+  void
+  start (std::chrono::microseconds interval);
+
+  void
+  stop ();
+
+  /// Probe interface, publishes the current instruction to the handler.
+  void
+  step (const instruction_t &instruction)
+  {
+    current_.store (&instruction, std::memory_order_relaxed);
+  }
+
+  /// Writes the samples taken while running @a program as folded stacks.
+  void
+  report (const program_t &program, std::ostream &out) const;
+
+  /// Samples that didn't fit in the buffer.
+  size_t
+  dropped () const;
+
+private:
+  static void
+  handle (int);
+
+  static std::atomic <const instruction_t *> current_;
+  static std::atomic <size_t> count_;
+  static const instruction_t **samples_;
+  static size_t capacity_;
+
+  std::unique_ptr <const instruction_t *[]> buffer_;
+  struct sigaction previous_;
+  bool running_;
+
+  sampler_t (const sampler_t &) = delete;
+  sampler_t & operator = (const sampler_t &) = delete;
+};
+
+/// Loop trip count instrumentation. Records, for every loop, a histogram of
+/// the iterations its body ran per entry into the loop, in power of two
+/// buckets: the first counts entries that skipped the body, bucket `b > 0`
+/// those that ran it between `2^(b-1)` and `2^b - 1` times.
+class trip_counter_t
+{
+public:
+  explicit trip_counter_t (const program_t &program);
+
+  /// Probe interface. Only executing a loop's '[' enters it, as jumping
+  /// back from its ']' lands past the '['; each ']' ends an iteration.
+  void
+  step (const instruction_t &instruction)
+  {
+    if ('[' == instruction.op)
+      enter (&instruction - base_);
+    else if (']' == instruction.op)
+      ++loops_[loop_[instruction.jump]].trips;
+  }
+
+  /// Writes the histograms as a JSON array, one object per loop, with the
+  /// source positions of its brackets, its entries and iterations, and the
+  /// nonempty buckets keyed by their least trip count.
+  void
+  report (std::ostream &out) const;
+
+private:
+  static const int BUCKET_COUNT = 65;
+
+  struct loop_t
+  {
+    size_t open;
+    bool entered = false;
+
+    /// Iterations since the last entry, and in earlier ones.
+    size_t trips = 0;
+    size_t iterations = 0;
+
+    std::array <size_t, BUCKET_COUNT> buckets {};
+  };
+
+  /// @return The bucket counting @a trips.
+  static int
+  bucket (size_t trips)
+  {
+    return trips ? 64 - __builtin_clzll (trips) : 0;
+  }
+
+  void
+  enter (size_t index);
+
+  const program_t &program_;
+  const instruction_t *base_;
+
+  /// Loop of each '[', by instruction index.
+  std::vector <size_t> loop_;
+
+  std::vector <loop_t> loops_;
+};
+
+/// Output buffer writing straight to a file descriptor. When the descriptor
+/// is a pipe, the buffer is a pair of page aligned halves, each as large as
+/// the pipe itself: a full half is handed to the pipe with vmsplice, so the
+/// kernel references the pages instead of copying them, and output carries
+/// on in the other half. Once the second half has been spliced in completely
+/// it occupied the whole pipe, so the first has been consumed and is safe to
+/// reuse. Partial flushes, and anything that isn't a pipe, go through write.
+class output_buffer_t : public std::streambuf
+{
+public:
+  /// @throw std::runtime_error if the buffer can't be allocated.
+  explicit output_buffer_t (int fd);
+
+  ~output_buffer_t ();
+
+protected:
+  int_type
+  overflow (int_type c) override;
+
+  int
+  sync () override;
+
+private:
+  /// Hands the buffered output to the kernel.
+  /// @return false on error.
+  bool
+  drain ();
+
+  int fd_;
+  bool splice_;
+  size_t size_;
+  char *pages_;
+  size_t half_;
+
+  output_buffer_t (const output_buffer_t &) = delete;
+  output_buffer_t & operator = (const output_buffer_t &) = delete;
+};
+
+/// Input buffer reading a file descriptor ahead of its consumer: a thread
+/// fills a ring of chunks with read while the program consumes earlier ones,
+/// so `,` only waits when the program outruns the file. Regular files are
+/// also advised as read sequentially, which enlarges the kernel's own
+/// readahead; those fitting a single chunk are read up front, without a
+/// thread.
+///
+/// Anything else (pipes, terminals) may block indefinitely, and what it
+/// delivers may depend on the output so far, so it is read a chunk at a
+/// time as the consumer needs it, after flushing @a tie if the read would
+/// block.
+class input_buffer_t : public std::streambuf
+{
+public:
+  explicit input_buffer_t (int fd, std::streambuf *tie = nullptr);
+
+  ~input_buffer_t ();
+
+protected:
+  int_type
+  underflow () override;
+
+private:
+  static const size_t CHUNK_SIZE = 1 << 16;
+  static const size_t CHUNK_COUNT = 8;
+
+  struct chunk_t
+  {
+    char data[CHUNK_SIZE];
+    size_t length;
+  };
+
+  /// Reads the descriptor into the ring until the end, an error, or the
+  /// destructor.
+  void
+  fill ();
+
+  /// Reads once into the next free chunk, and publishes it, or the end.
+  void
+  read_chunk ();
+
+  int fd_;
+  std::streambuf *tie_;
+
+  /// Whether chunks are read on demand, by the consumer.
+  bool synchronous_;
+
+  size_t count_;
+  std::unique_ptr <chunk_t []> chunks_;
+
+  /// Chunks filled and consumed so far; chunk `n` lives in slot
+  /// `n % count_`, and the consumer holds the one it reads from.
+  size_t filled_;
+  size_t consumed_;
+  bool holding_;
+
+  /// Whether fill () is done.
+  bool end_;
+  bool stopping_;
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::thread thread_;
+
+  input_buffer_t (const input_buffer_t &) = delete;
+  input_buffer_t & operator = (const input_buffer_t &) = delete;
+};
+
+/// A BF tape, zeroed and unbounded to the right, with a cursor. The cells are
+/// kept in fixed size pages, which copies of a tape share until the cursor
+/// enters them: a copy costs a page table, then a page per page it goes on
+/// to touch. The tape copied from may be copied again concurrently, but must
+/// not run meanwhile.
+class tape_t
+{
+public:
+  static const size_t PAGE_SIZE = 4096;
+
+  tape_t ();
+
+  /// Copies would share the page under the original's cursor, which only
+  /// operator = takes.
+  tape_t (const tape_t &) = delete;
+
+  /// Shares @a other's pages, and takes its cursor position.
+  tape_t &
+  operator = (const tape_t &other);
+
+  /// The cell under the cursor.
+  unsigned char &
+  cell () { return *cell_; }
+
+  /// Moves the cursor right.
+  void
+  next ();
+
+  /// Moves the cursor left.
+  /// @throw std::underflow_error if the cursor is on the first cell.
+  void
+  prev ();
+
+  /// The cell @a offset cells from the cursor, which mustn't be before the
+  /// first. The reference is valid until the tape next changes.
+  unsigned char &
+  at (ptrdiff_t offset)
+  {
+    const size_t slot = cell_ - page_begin_ + offset;
+    return slot < PAGE_SIZE ? page_begin_[slot] : far (offset);
+  }
+
+  /// Moves the cursor by @a distance, which mustn't take it past the first
+  /// cell.
+  void
+  move (ptrdiff_t distance)
+  {
+    const ptrdiff_t offset = cell_ - page_begin_ + distance;
+    if (offset >= 0 && offset < ptrdiff_t (PAGE_SIZE))
+      cell_ += distance;
+    else
+      seek (position () + distance);
+  }
+
+  /// @return The cursor's position.
+  size_t
+  position () const { return page_ * PAGE_SIZE + (cell_ - page_begin_); }
+
+  /// Moves the cursor to @a slot.
+  void
+  seek (size_t slot) { enter (slot / PAGE_SIZE, slot % PAGE_SIZE); }
+
+  /// @return The value of cell @a slot, without taking its page.
+  unsigned char
+  get (size_t slot) const;
+
+  /// @return The number of cells from the first which may be nonzero.
+  size_t
+  size () const { return high_ * PAGE_SIZE; }
+
+  /// Zeroes the tape, and moves the cursor to the first cell. Only pages
+  /// entered since the last clear () are zeroed; those past the first
+  /// @a retained cells are released instead.
+  void
+  clear (size_t retained);
+
+private:
+  typedef std::array <unsigned char, PAGE_SIZE> page_t;
+
+  /// Moves the cursor to @a offset in page @a page, which it takes: a page
+  /// still shared is copied first, a missing one allocated.
+  void
+  enter (size_t page, size_t offset);
+
+  /// @return Whether @a page belongs to this tape alone.
+  static bool
+  owned (const std::shared_ptr <page_t> &page);
+
+  /// at () for a cell on another page.
+  unsigned char &
+  far (ptrdiff_t offset);
+
+  std::vector <std::shared_ptr <page_t>> pages_;
+  size_t page_;
+  unsigned char *page_begin_;
+  unsigned char *page_end_;
+  unsigned char *cell_;
+
+  /// Pages that may hold anything but zeros.
+  size_t high_;
+};
+
+class context_t
+{
+public:
+  /// Constructor.
+  context_t ();
+
+  /// Executes a compiled BF program, in its optimized form.
+  /// @throw std::runtime_error if the maximum number of operations is
+  /// exceeded.
+  size_t
+  execute (const program_t &program, std::istream &input, std::ostream &out);
+
+  /// Executes a compiled BF program, showing each instruction to @a probe
+  /// before it runs.
+  /// @throw std::runtime_error if the maximum number of operations is
+  /// exceeded.
+  template <typename probe_t>
+  size_t
+  execute (
+    const program_t &program, std::istream &input, std::ostream &out,
+    probe_t &probe
+  );
+
+  /// Executes a compiled BF program, running the segments of @a plan
+  /// concurrently on up to @a jobs threads. Produces the same output, tape and
+  /// operation count as execute(); falls back to it when the plan has a
+  /// single segment, the context has already run code, or the operation limit
+  /// is hit.
+  /// @throw std::runtime_error if the maximum number of operations is
+  /// exceeded.
+  size_t
+  execute (
+    const program_t &program, const segment_plan_t &plan, std::istream &input,
+    std::ostream &out, size_t jobs
+  );
+
+  /// Sets the maximum number of operations, and returns the old value.
+  size_t
+  set_max_operations (size_t max_operations);
+
+  /// Returns the context to its initial state (zeroed tape, no operations
+  /// executed), keeping the operation limit. Only the pages touched since
+  /// the last reset are cleared, and they are kept for the next run up to
+  /// RETAINED_SLOTS.
+  void
+  reset ();
+
+  /// Makes @a copy a copy of this context: its tape, position, operation
+  /// count and limit. The tapes share pages copy-on-write, so cloning costs
+  /// little until the copy runs, whatever the size of the tape. A context
+  /// may be cloned by several threads at once, as long as it doesn't run.
+  void
+  clone (context_t *copy) const;
+
+  /// @return The operations executed since construction or the last reset.
+  size_t
+  operations () const { return operation_count_; }
+
+  /// Executes @a program from instruction @a ip until it ends, reaches a
+  /// BREAK_OP, which isn't executed or counted, or the operation count
+  /// reaches @a until.
+  /// @return The index of the instruction it stopped before, or the
+  /// program's size.
+  /// @throw std::runtime_error if the maximum number of operations is
+  /// exceeded.
+  size_t
+  resume (
+    const program_t &program, size_t ip, std::istream &input,
+    std::ostream &out, size_t until = SIZE_MAX
+  );
+
+  /// Like resume (), but in the optimized form from the first instruction
+  /// on which it can take over, as listed by @a entries (see
+  /// program_t::fused_entries ()). The plain interpreter only leads up to
+  /// it, and lands on @a until exactly. Breakpoints aren't seen, as the
+  /// optimized form isn't patched.
+  size_t
+  resume (
+    const program_t &program, const std::vector <size_t> &entries, size_t ip,
+    std::istream &input, std::ostream &out, size_t until
+  );
+
+  /// Puts the context in the state described by @a cells (from the first
+  /// slot on, the rest being zeros), @a position and @a operations, keeping
+  /// the operation limit.
+  void
+  restore (const std::string &cells, size_t position, size_t operations);
+
+  /// @return The slot the pointer is on.
+  size_t
+  position () const { return tape_.position (); }
+
+  /// @return The value of @a slot.
+  unsigned char
+  cell (size_t slot) const { return tape_.get (slot); }
+
+  /// @return The number of slots from the first which may be nonzero.
+  size_t
+  tape_size () const { return tape_.size (); }
+
+private:
+  typedef program_t::const_iterator code_iterator_t;
+
+  /// Tape kept across reset ().
+  static const size_t RETAINED_SLOTS = 1 << 16;
+
+  /// Executes [@a first, @a last) of the program starting at @a code_begin.
+  template <typename probe_t>
+  size_t
+  run (
+    code_iterator_t code_begin, code_iterator_t first, code_iterator_t last,
+    std::istream &input, std::ostream &out, probe_t &probe
+  );
+
+  /// Executes the optimized form of @a program, from op @a first. An op
+  /// that would hit the operation limit, or move the pointer off the tape,
+  /// hands over to run (), which finds where exactly.
+  size_t
+  run_fused (
+    const program_t &program, std::istream &input, std::ostream &out,
+    size_t first = 0
+  );
+
+  /// Executes the fused op @a f, which doesn't branch, without checks, and
+  /// with additions multiplied by @a scale.
+  void
+  apply (
+    const fused_t &f, unsigned char scale, std::istream &input,
+    std::ostream &out )
+  {
+    switch (f.op)
+    {
+    case '+': tape_.at (f.offset) += f.arg * scale; break;
+    case '>': tape_.move (f.arg); break;
+    default: transfer (f, input, out); break;
+    }
+  }
+
+  /// Outputs or inputs as the fused op @a f says.
+  void
+  transfer (const fused_t &f, std::istream &input, std::ostream &out);
+
+  /// Executes the fused ops in [@a first, @a last) as apply () does.
+  void
+  run_body (
+    const fused_t *first, const fused_t *last, unsigned char scale,
+    std::istream &input, std::ostream &out )
+  {
+    for (auto f = first; f != last; ++f)
+      apply (*f, scale, input, out);
+  }
+
+  void
+  increment ();
+
+  void
+  decrement ();
+
+  /// @throw std::underflow_error
+  void
+  prev_slot ();
+
+  void
+  next_slot ();
+
+  void
+  send_out (std::ostream &out);
+
+  void
+  read_in (std::istream &input);
+
+  void
+  start_loop (code_iterator_t *it, code_iterator_t code_begin);
+
+  void
+  end_loop (code_iterator_t *it, code_iterator_t code_begin);
+
+  /**/
+
+  tape_t tape_;
+  size_t operation_count_max_;
+  size_t operation_count_;
+
+  /// Where run () last reached a BREAK_OP, or the operation limit.
+  code_iterator_t stopped_;
+
+  context_t (const context_t &) = delete;
+  context_t & operator = (const context_t &) = delete;
+};
+
+} // anonymous namespace
+
+arena_t::arena_t (size_t block_size)
+: block_size_ (block_size),
+  current_    (0),
+  next_       (nullptr),
+  end_        (nullptr)
+{
+}
+
+arena_t::~arena_t ()
+{
+  for (const auto &block : blocks_)
+    ::operator delete (block.data);
+}
+
+void *
+arena_t::allocate (size_t size, size_t alignment)
+{
+  for (;;)
+  {
+    // Checked apart, so padding that runs past the block can't wrap around.
+    const auto at = reinterpret_cast <uintptr_t> (next_);
+    const size_t padding = (alignment - at % alignment) % alignment;
+    const size_t left = end_ - next_;
+    if (next_ && left >= padding && left - padding >= size)
+    {
+      char *aligned = next_ + padding;
+      next_ = aligned + size;
+      return aligned;
+    }
+
+    // Move on to the next block kept from before the last reset, or add one
+    // large enough.
+    if (next_)
+      ++current_;
+    if (current_ == blocks_.size ())
+    {
+      const size_t block_size = std::max (block_size_, size + alignment);
+      blocks_.push_back (
+        {static_cast <char *> (::operator new (block_size)), block_size}
+      );
+    }
+    next_ = blocks_[current_].data;
+    end_ = next_ + blocks_[current_].size;
+  }
+}
+
+void
+arena_t::reset ()
+{
+  current_ = 0;
+  next_ = end_ = nullptr;
+}
+
+template <typename iterator_t>
+program_t::program_t (
+  iterator_t code_begin, iterator_t code_end, arena_t *arena )
+: instructions_ (arena),
+  fused_        (arena)
+{
+  instructions_.reserve (std::distance (code_begin, code_end));
+  std::stack <size_t, std::vector <size_t, arena_allocator_t <size_t>>> stash (
+    arena
+  );
+  size_t position = 0;
+  for (auto cp = code_begin; cp != code_end; ++cp, ++position)
+  {
+    switch (*cp)
+    {
+    case '+': case '-': case '<': case '>': case '.': case ',':
+      instructions_.push_back ({*cp, 0, position});
+      break;
+    case '[':
+      stash.push (instructions_.size ());
+      instructions_.push_back ({*cp, 0, position});
+      break;
+    case ']':
+      if (stash.empty ())
+        throw std::runtime_error ("bracket mismatch (no opening)");
+
+      instructions_[stash.top ()].jump = instructions_.size ();
+      instructions_.push_back ({*cp, stash.top (), position});
+      stash.pop ();
+      break;
+    }
+  }
+
+  if (!stash.empty ())
+    throw std::runtime_error ("bracket mismatch (no closing)");
+
+  fuse ();
+}
+
+program_t::program_t (
+  const instruction_t *instructions, size_t size, const fused_t *fused,
+  size_t fused_size )
+: instructions_ (instructions, instructions + size),
+  fused_        (fused, fused + fused_size)
+{
+}
+
+void
+program_t::fused_entries (std::vector <size_t> *entries) const
+{
+  // run_fused () only checks, and hands over from, the first op of a block
+  // and loops as a whole; the others may stand for reordered instructions.
+  entries->assign (size (), SIZE_MAX);
+  for (size_t ip = 0; ip < fused_.size (); ++ip)
+  {
+    const fused_t &f = fused_[ip];
+    if (SIZE_MAX == (*entries)[f.origin])
+      (*entries)[f.origin] = ip;
+    if ('[' != f.op && ']' != f.op)
+      ip = f.jump - 1;
+  }
+}
+
+void
+program_t::fuse ()
+{
+  const ir_t ir (
+    instructions_.data (), instructions_.size (),
+    instructions_.get_allocator ().arena ()
+  );
+  fused_.reserve (instructions_.size ());
+  ir.lower (&fused_);
+}
+
+ir_t::ir_t (
+  const instruction_t *instructions, size_t size, arena_t *arena )
+: arena_    (arena),
+  program_  (arena),
+  loops_    (arena),
+  blocks_   (arena)
+{
+  size_t loop = NONE;
+  size_t first = 0;
+  for (size_t i = 0; i < size; ++i)
+  {
+    const char op = instructions[i].op;
+    if ('[' != op && ']' != op)
+      continue;
+
+    if (first < i)
+    {
+      scan (instructions, first, i);
+      (NONE == loop ? program_ : loops_[loop].body).push_back (
+        {false, blocks_.size () - 1}
+      );
+    }
+    first = i + 1;
+
+    if ('[' == op)
+    {
+      (NONE == loop ? program_ : loops_[loop].body).push_back (
+        {true, loops_.size ()}
+      );
+      loops_.emplace_back (i, instructions[i].jump, loop, arena_);
+      loop = loops_.size () - 1;
+    }
+    else
+    {
+      // Loops running any number of times add nothing to the lowest move
+      // they make, as long as it isn't negative.
+      loop_t &closed = loops_[loop];
+      ptrdiff_t move = 0;
+      closed.advancing = std::all_of (
+        begin (closed.body), end (closed.body),
+        [&] (const node_t &node) {
+          if (!node.loop)
+            move += blocks_[node.index].move;
+          return !node.loop || loops_[node.index].advancing;
+        }
+      ) && move >= 0;
+      loop = closed.parent;
+    }
+  }
+
+  if (first < size)
+  {
+    scan (instructions, first, size);
+    program_.push_back ({false, blocks_.size () - 1});
+  }
+}
+
+void
+ir_t::scan (const instruction_t *instructions, size_t first, size_t last)
+{
+  blocks_.emplace_back (arena_);
+  block_t &block = blocks_.back ();
+  block.first = first;
+  block.last = last;
+
+  size_t values = 0;
+  auto value = [&] (ptrdiff_t offset) -> value_t & {
+    auto e = block.exit.find (offset);
+    if (block.exit.end () != e)
+      return e->second;
+
+    auto entry = block.entry.find (offset);
+    if (block.entry.end () == entry)
+      entry = block.entry.emplace (offset, values++).first;
+    return block.exit[offset] = {entry->second, 0};
+  };
+
+  ptrdiff_t slot = 0, low = 0;
+  for (size_t i = first; i < last; ++i)
+  {
+    switch (instructions[i].op)
+    {
+    case '+': ++value (slot).addend; break;
+    case '-': --value (slot).addend; break;
+    case '>': ++slot; break;
+    case '<': low = std::min (low, --slot); break;
+    case '.':
+      block.effects.push_back ({'.', slot, value (slot), NONE});
+      break;
+    case ',':
+    {
+      value_t &v = value (slot);
+      block.effects.push_back ({',', slot, v, values});
+      v = {values++, 0};
+      break;
+    }
+    }
+  }
+  block.move = slot;
+  block.low = low;
+}
+
+void
+ir_t::lower (fused_code_t *code) const
+{
+  size_t floor = 0;
+  lower (program_, code, &floor);
+}
+
+void
+ir_t::lower (
+  const node_container_t &nodes, fused_code_t *code, size_t *floor
+) const
+{
+  auto check = [floor] (const block_t &block, fused_t *first) {
+    if (*floor >= size_t (-block.low))
+      first->low = 0;
+  };
+
+  for (const auto &node : nodes)
+  {
+    if (!node.loop)
+    {
+      // A block without ops (which only moves the pointer back where it
+      // was) still needs one for its cost.
+      const block_t &block = blocks_[node.index];
+      const size_t header = code->size ();
+      lower_block (block, code);
+      if (code->size () == header)
+        code->push_back ({'>', 0, 0, 0, 0, 0, 0});
+
+      fused_t &first = (*code)[header];
+      first.jump = code->size ();
+      first.cost = block.last - block.first;
+      first.origin = block.first;
+      first.low = block.low;
+      check (block, &first);
+
+      // Past its check, the pointer is at least as high as that demands.
+      *floor = std::max (*floor, size_t (-block.low)) + block.move;
+      continue;
+    }
+
+    const loop_t &loop = loops_[node.index];
+    const size_t open = code->size ();
+    const block_t *block;
+    if (fixed (loop, &block))
+    {
+      const unsigned char step = block->exit.at (0).addend;
+      code->push_back ({
+        block->effects.empty () ? SCALE_OP : REPEAT_OP, 1, 0, 0,
+        1 + block->last - block->first, loop.open, block->low
+      });
+      while ((code->back ().arg * step & 0xff) != 1)
+        code->back ().arg += 2;
+
+      // What no output in the body reads needn't change every trip: it
+      // is changed once, by as much as all the trips would.
+      const size_t sunk = lower_block (*block, code);
+      (*code)[open].offset = code->size () - open - 1 - sunk;
+      (*code)[open].jump = code->size ();
+      check (*block, &(*code)[open]);
+      continue;
+    }
+
+    // The loop exits where it entered or where its body left the pointer.
+    size_t inner = loop.advancing ? *floor : 0;
+    code->push_back ({'[', 0, 0, 0, 1, loop.open, 0});
+    lower (loop.body, code, &inner);
+    *floor = std::min (*floor, inner);
+    code->push_back ({']', 0, 0, open, 1, loop.close, 0});
+    (*code)[open].jump = code->size () - 1;
+  }
+}
+
+size_t
+ir_t::lower_block (const block_t &block, fused_code_t *code) const
+{
+  // What the cells hold, as the ops emitted so far leave them.
+  value_map_t held (arena_);
+  auto settle = [&] (ptrdiff_t offset, value_t value) {
+    auto h = held.find (offset);
+    const unsigned char addend = held.end () == h ? 0 : h->second.addend;
+    if (value.addend != addend)
+    {
+      code->push_back (
+        {'+', (unsigned char) (value.addend - addend), offset, 0, 0, 0, 0}
+      );
+    }
+    held[offset] = value;
+  };
+
+  for (const auto &effect : block.effects)
+  {
+    settle (effect.offset, effect.value);
+    code->push_back ({effect.op, 0, effect.offset, 0, 0, 0, 0});
+    if (',' == effect.op)
+      held[effect.offset] = {effect.result, 0};
+  }
+  for (const auto &exit : block.exit)
+  {
+    if (held.count (exit.first))
+      settle (exit.first, exit.second);
+  }
+
+  const size_t observed = code->size ();
+  for (const auto &exit : block.exit)
+  {
+    if (!held.count (exit.first))
+      settle (exit.first, exit.second);
+  }
+  if (block.move)
+    code->push_back ({'>', block.move, 0, 0, 0, 0, 0});
+  return code->size () - observed;
+}
+
+bool
+ir_t::fixed (const loop_t &loop, const block_t **block) const
+{
+  // An empty loop either never runs or never ends.
+  if (1 != loop.body.size () || loop.body.front ().loop)
+    return false;
+
+  // Returning to its counter, and changing it by an odd step, the loop
+  // runs as often as the step takes to bring the counter to 0.
+  const block_t &b = blocks_[loop.body.front ().index];
+  auto counter = b.exit.find (0);
+  *block = &b;
+  return !b.move && b.exit.end () != counter && (counter->second.addend & 1)
+    && std::none_of (
+      begin (b.effects), end (b.effects),
+      [] (const effect_t &effect) { return ',' == effect.op; }
+    );
+}
+
+segment_plan_t::segment_plan_t (const program_t &program, arena_t *arena)
+: arena_    (arena),
+  segments_ (arena),
+  exit_     (0),
+  writer_   (arena)
+{
+  const auto code_begin = program.begin ();
+  ptrdiff_t slot = 0;
+  for (auto ip = code_begin; ip != program.end (); ++ip)
+  {
+    segment_t segment (arena_);
+    segment.first = ip - code_begin;
+    segment.entry = slot;
+    segment.high = slot;
+    segment.loops = 0;
+
+    bool ok = true;
+    switch (ip->op)
+    {
+    case '+': case '-':
+      segment.reads.insert (slot);
+      segment.writes.insert (slot);
+      break;
+    case '.':
+      segment.reads.insert (slot);
+      break;
+    case '<':
+      ok = --slot >= 0;
+      break;
+    case '>':
+      segment.high = ++slot;
+      break;
+    case ',':
+      ok = false;
+      break;
+    case '[':
+      if (2 == ip->jump - segment.first && ('-' == ip[1].op || '+' == ip[1].op))
+      {
+        segment.clears.push_back ({slot, ip[1].op});
+        segment.writes.insert (slot);
+      }
+      else
+      {
+        ok = trace_loop (code_begin, ip, slot, &segment);
+      }
+      ip = code_begin + ip->jump;
+      break;
+    }
+
+    if (!ok)
+    {
+      segments_.clear ();
+      return;
+    }
+    segment.last = ip - code_begin + 1;
+
+    const bool depends = std::any_of (
+      begin (segment.reads), end (segment.reads),
+      [this] (ptrdiff_t r) { return writer_.count (r); }
+    );
+    if (segments_.empty () || (!depends && segments_.back ().loops))
+    {
+      segments_.push_back (std::move (segment));
+      for (auto w : segments_.back ().writes)
+        writer_.emplace (w, segments_.size () - 1);
+      continue;
+    }
+
+    // Joining a segment may make it depend on an earlier one, in which case
+    // the two have to be joined as well.
+    merge (&segment);
+    while (segments_.size () > 1)
+    {
+      const size_t index = segments_.size () - 1;
+      const auto &reads = segments_.back ().reads;
+      const bool earlier = std::any_of (
+        begin (reads), end (reads), [&] (ptrdiff_t r) {
+          auto w = writer_.find (r);
+          return w != end (writer_) && w->second < index;
+        }
+      );
+      if (!earlier)
+        break;
+
+      segment = std::move (segments_.back ());
+      segments_.pop_back ();
+      merge (&segment);
+    }
+  }
+
+  exit_ = slot;
+}
+
+bool
+segment_plan_t::trace_loop (
+  program_t::const_iterator code_begin, program_t::const_iterator ip,
+  ptrdiff_t slot, segment_t *segment )
+{
+  // The body may run any number of times, so every slot it touches depends
+  // on the value it had before the loop, unless the segment set it already.
+  typedef std::vector <ptrdiff_t, arena_allocator_t <ptrdiff_t>> slots_t;
+  slots_t touched (1, slot, arena_), modified (arena_), opened (arena_);
+  for (auto cp = ip + 1, close = code_begin + ip->jump; cp != close; ++cp)
+  {
+    switch (cp->op)
+    {
+    case '+': case '-':
+      modified.push_back (slot);
+      touched.push_back (slot);
+      break;
+    case '.':
+      touched.push_back (slot);
+      break;
+    case '<':
+      if (--slot < 0)
+        return false;
+      break;
+    case '>':
+      segment->high = std::max (segment->high, ++slot);
+      break;
+    case ',':
+      return false;
+    case '[':
+      touched.push_back (slot);
+      opened.push_back (slot);
+      break;
+    case ']':
+      if (opened.back () != slot)
+        return false;
+      opened.pop_back ();
+      break;
+    }
+  }
+
+  if (slot != touched.front ())
+    return false;
+
+  for (auto t : touched)
+  {
+    if (!segment->writes.count (t))
+      segment->reads.insert (t);
+  }
+  segment->writes.insert (begin (modified), end (modified));
+  ++segment->loops;
+  return true;
+}
+
+void
+segment_plan_t::merge (segment_t *segment)
+{
+  auto &last = segments_.back ();
+  for (auto r : segment->reads)
+  {
+    if (!last.writes.count (r))
+      last.reads.insert (r);
+  }
+  for (const auto &clear : segment->clears)
+  {
+    if (!last.writes.count (clear.slot))
+      last.clears.push_back (clear);
+  }
+  for (auto w : segment->writes)
+  {
+    last.writes.insert (w);
+    auto &writer = writer_.emplace (w, segments_.size () - 1).first->second;
+    writer = std::min (writer, segments_.size () - 1);
+  }
+
+  last.last = segment->last;
+  last.high = std::max (last.high, segment->high);
+  last.loops += segment->loops;
+}
+
+/// @return @a a + @a b, or cost_estimate_t::UNBOUNDED on overflow.
+static size_t
+add_cost (size_t a, size_t b)
+{
+  return a > cost_estimate_t::UNBOUNDED - b
+    ? cost_estimate_t::UNBOUNDED : a + b;
+}
+
+/// @return @a a * @a b, or cost_estimate_t::UNBOUNDED on overflow.
+static size_t
+multiply_cost (size_t a, size_t b)
+{
+  return b && a > cost_estimate_t::UNBOUNDED / b
+    ? cost_estimate_t::UNBOUNDED : a * b;
+}
+
+cost_estimate_t::cost_estimate_t (const program_t &program, arena_t *arena)
+: arena_ (arena),
+  code_begin_ (program.begin ()),
+  gave_up_ (false),
+  steps_ (0),
+  high_ (0)
+{
+  ptrdiff_t slot = 0;
+  cells_t cells (arena_);
+  operations_ = walk (program.begin (), program.end (), &slot, &cells);
+  tape_ = high_ + 1;
+  if (gave_up_)
+    operations_ = tape_ = UNBOUNDED;
+}
+
+size_t
+cost_estimate_t::walk (
+  program_t::const_iterator first, program_t::const_iterator last,
+  ptrdiff_t *slot, cells_t *cells )
+{
+  size_t cost = 0;
+  for (auto ip = first; ip != last && !gave_up_; ++ip)
+  {
+    if (++steps_ > STEP_LIMIT)
+      gave_up_ = true;
+
+    switch (ip->op)
+    {
+    case '+': case '-':
+      {
+        int &value = (*cells)[*slot];
+        if (UNKNOWN != value)
+          value = (value + ('+' == ip->op ? 1 : 255)) % 256;
+      }
+      break;
+    case '<':
+      --*slot;
+      break;
+    case '>':
+      high_ = std::max (high_, ++*slot);
+      break;
+    case ',':
+      (*cells)[*slot] = UNKNOWN;
+      break;
+    case '[':
+      // The loop accounts for its own '['.
+      cost = add_cost (cost, loop (ip, *slot, cells) - 1);
+      ip = code_begin_ + ip->jump;
+      break;
+    }
+
+    cost = add_cost (cost, 1);
+  }
+
+  return cost;
+}
+
+size_t
+cost_estimate_t::loop (
+  program_t::const_iterator ip, ptrdiff_t slot, cells_t *cells )
+{
+  const auto first = ip + 1, last = code_begin_ + ip->jump;
+  auto found = cells->find (slot);
+  const int counter = end (*cells) == found ? 0 : found->second;
+  if (!counter)
+    return 1;
+
+  // How much each iteration adds to the cells it only changes at its top
+  // level, by offset from the counter; the cells changed any other way.
+  cells_t step (arena_);
+  std::set <
+    ptrdiff_t, std::less <ptrdiff_t>, arena_allocator_t <ptrdiff_t>
+  > changed (arena_);
+  std::vector <ptrdiff_t, arena_allocator_t <ptrdiff_t>> opened (arena_);
+  ptrdiff_t offset = 0;
+  for (auto cp = first; cp != last; ++cp)
+  {
+    if (++steps_ > STEP_LIMIT)
+      break;
+
+    switch (cp->op)
+    {
+    case '+': case '-':
+      if (opened.empty ())
+        step[offset] += '+' == cp->op ? 1 : -1;
+      else
+        changed.insert (offset);
+      break;
+    case '<': --offset; break;
+    case '>': ++offset; break;
+    case ',': changed.insert (offset); break;
+    case '[': opened.push_back (offset); break;
+    case ']':
+      if (opened.back () != offset)
+        gave_up_ = true;
+      opened.pop_back ();
+      break;
+    }
+  }
+  if (offset || steps_ > STEP_LIMIT)
+    gave_up_ = true;
+  if (gave_up_)
+    return UNBOUNDED;
+
+  // Widen the entry state until it covers the cells at the start of every
+  // iteration; the body's cost from there bounds each iteration's.
+  cells_t entry = *cells, after (arena_);
+  size_t body = 0;
+  for (bool widened = true; widened && !gave_up_; )
+  {
+    after = entry;
+    ptrdiff_t s = slot;
+    body = walk (first, last, &s, &after);
+
+    widened = false;
+    for (const auto &cell : after)
+    {
+      int &value = entry[cell.first];
+      if (UNKNOWN != value && value != cell.second)
+      {
+        value = UNKNOWN;
+        widened = true;
+      }
+    }
+  }
+  if (gave_up_)
+    return UNBOUNDED;
+
+  size_t trips = UNBOUNDED;
+  const int delta = changed.count (0) ? 0 : (step[0] % 256 + 256) % 256;
+  if (delta && UNKNOWN != counter)
+  {
+    for (size_t k = 1; k <= 256 && UNBOUNDED == trips; ++k)
+    {
+      if (!((counter + k * delta) % 256))
+        trips = k;
+    }
+  }
+  else if (delta % 2)
+    trips = 255;
+  else if (0 == after[slot])
+    trips = 1;
+
+  // Leaving the loop clears its counter. With an exact trip count, cells
+  // only stepped by the body's top level end up at a known value too.
+  entry[slot] = 0;
+  if (delta && UNKNOWN != counter && UNBOUNDED != trips)
+  {
+    for (const auto &s : step)
+    {
+      auto value = cells->find (slot + s.first);
+      const int initial = end (*cells) == value ? 0 : value->second;
+      if (s.first && !changed.count (s.first) && UNKNOWN != initial)
+      {
+        entry[slot + s.first] =
+          ((initial + ptrdiff_t (trips) * s.second) % 256 + 256) % 256;
+      }
+    }
+  }
+  *cells = std::move (entry);
+
+  return add_cost (1, multiply_cost (trips, add_cost (body, 1)));
+}
+
+std::atomic <const instruction_t *> sampler_t::current_ (nullptr);
+std::atomic <size_t> sampler_t::count_ (0);
+const instruction_t **sampler_t::samples_ = nullptr;
+size_t sampler_t::capacity_ = 0;
+
+sampler_t::sampler_t (size_t capacity)
+: buffer_  (new const instruction_t *[capacity]),
+  running_ (false)
+{
+  samples_ = buffer_.get ();
+  capacity_ = capacity;
+  count_ = 0;
+}
+
+sampler_t::~sampler_t ()
+{
+  stop ();
+  samples_ = nullptr;
+  capacity_ = 0;
+}
+
+void
+sampler_t::start (std::chrono::microseconds interval)
+{
+  struct sigaction action;
+  std::memset (&action, 0, sizeof action);
+  action.sa_handler = handle;
+  action.sa_flags = SA_RESTART;
+  sigemptyset (&action.sa_mask);
+  if (sigaction (SIGPROF, &action, &previous_))
+    throw std::runtime_error ("unable to install SIGPROF handler");
+
+  itimerval timer;
+  timer.it_interval.tv_sec = interval.count () / 1000000;
+  timer.it_interval.tv_usec = interval.count () % 1000000;
+  timer.it_value = timer.it_interval;
+  if (setitimer (ITIMER_PROF, &timer, nullptr))
+  {
+    sigaction (SIGPROF, &previous_, nullptr);
+    throw std::runtime_error ("unable to start profiling timer");
+  }
+  running_ = true;
+}
+
+void
+sampler_t::stop ()
+{
+  if (!running_)
+    return;
+
+  itimerval timer;
+  std::memset (&timer, 0, sizeof timer);
+  setitimer (ITIMER_PROF, &timer, nullptr);
+  sigaction (SIGPROF, &previous_, nullptr);
+  current_ = nullptr;
+  running_ = false;
+}
+
+void
+sampler_t::handle (int)
+{
+  const instruction_t *current = current_.load (std::memory_order_relaxed);
+  if (!current)
+    return;
+
+  const size_t at = count_.fetch_add (1, std::memory_order_relaxed);
+  if (at < capacity_)
+    samples_[at] = current;
+}
+
+size_t
+sampler_t::dropped () const
+{
+  return count_ > capacity_ ? count_ - capacity_ : 0;
+}
+
+void
+sampler_t::report (const program_t &program, std::ostream &out) const
+{
+  static const size_t NONE = -1;
+
+  // Innermost loop enclosing each instruction; a bracket belongs to its own
+  // loop.
+  std::vector <size_t> loop (program.size (), NONE);
+  std::vector <size_t> parent (program.size (), NONE);
+  std::stack <size_t> open;
+  for (size_t i = 0; i < program.size (); ++i)
+  {
+    const auto &instruction = program.begin ()[i];
+    if ('[' == instruction.op)
+    {
+      parent[i] = open.empty () ? NONE : open.top ();
+      open.push (i);
+    }
+    loop[i] = open.empty () ? NONE : open.top ();
+    if (']' == instruction.op)
+      open.pop ();
+  }
+
+  std::map <size_t, size_t> hits;
+  const auto base = &*program.begin ();
+  for (size_t i = 0, n = std::min (count_.load (), capacity_); i < n; ++i)
+    ++hits[samples_[i] - base];
+
+  std::vector <size_t> frames;
+  for (const auto &hit : hits)
+  {
+    frames.clear ();
+    for (size_t l = loop[hit.first]; NONE != l; l = parent[l])
+      frames.push_back (l);
+
+    out << "program";
+    for (auto frame = frames.rbegin (); frame != frames.rend (); ++frame)
+    {
+      const auto &open = program.begin ()[*frame];
+      out << ";[" << open.position << '-'
+        << program.begin ()[open.jump].position << ']';
+    }
+
+    const auto &instruction = program.begin ()[hit.first];
+    out << ';' << instruction.op << '@' << instruction.position
+      << ' ' << hit.second << '\n';
+  }
+}
+
+trip_counter_t::trip_counter_t (const program_t &program)
+: program_ (program),
+  base_    (&*program.begin ()),
+  loop_    (program.size ())
+{
+  for (size_t i = 0; i < program.size (); ++i)
+  {
+    if ('[' == program.begin ()[i].op)
+    {
+      loop_[i] = loops_.size ();
+      loops_.emplace_back ();
+      loops_.back ().open = i;
+    }
+  }
+}
+
+void
+trip_counter_t::enter (size_t index)
+{
+  // The previous entry ended when the loop was last left, which must have
+  // happened for the '[' to run again.
+  loop_t &loop = loops_[loop_[index]];
+  if (loop.entered)
+  {
+    ++loop.buckets[bucket (loop.trips)];
+    loop.iterations += loop.trips;
+  }
+  loop.entered = true;
+  loop.trips = 0;
+}
+
+void
+trip_counter_t::report (std::ostream &out) const
+{
+  out << "[\n";
+  for (size_t i = 0; i < loops_.size (); ++i)
+  {
+    const loop_t &loop = loops_[i];
+    const instruction_t &open = program_.begin ()[loop.open];
+
+    // The last entry is still open, the run having ended in the loop or
+    // after it.
+    auto buckets = loop.buckets;
+    if (loop.entered)
+      ++buckets[bucket (loop.trips)];
+
+    size_t entries = 0;
+    for (auto n : buckets)
+      entries += n;
+    out << "  {\"position\": " << open.position << ", \"end\": "
+      << program_.begin ()[open.jump].position << ", \"entries\": " << entries
+      << ", \"iterations\": " << loop.iterations + loop.trips
+      << ", \"histogram\": {";
+    const char *separator = "";
+    for (int b = 0; b < BUCKET_COUNT; ++b)
+    {
+      if (buckets[b])
+      {
+        out << separator << "\"" << (b ? uint64_t (1) << (b - 1) : 0)
+          << "\": " << buckets[b];
+        separator = ", ";
+      }
+    }
+    out << (i + 1 < loops_.size () ? "}},\n" : "}}\n");
+  }
+  out << "]\n";
+}
+
+output_buffer_t::output_buffer_t (int fd)
+: fd_     (fd),
+  splice_ (false),
+  size_   (1 << 16),
+  pages_  (nullptr),
+  half_   (0)
+{
+  struct stat st;
+  if (0 == fstat (fd, &st) && S_ISFIFO (st.st_mode))
+  {
+    // Larger pipes mean fewer wakeups; the system may cap the size.
+    (void) fcntl (fd, F_SETPIPE_SZ, 1 << 20);
+    const int pipe_size = fcntl (fd, F_GETPIPE_SZ);
+    if (pipe_size > 0)
+    {
+      size_ = pipe_size;
+      splice_ = true;
+    }
+  }
+
+  // Spliced pages may still sit in the pipe after this buffer is gone, so
+  // they are mapped (and unmapped) directly, never recycled by the heap.
+  void *pages = mmap (
+    nullptr, 2 * size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+    -1, 0
+  );
+  if (MAP_FAILED == pages)
+    throw std::runtime_error ("unable to allocate output buffer");
+
+  pages_ = static_cast <char *> (pages);
+  setp (pages_, pages_ + size_);
+}
+
+output_buffer_t::~output_buffer_t ()
+{
+  (void) drain ();
+  munmap (pages_, 2 * size_);
+}
+
+output_buffer_t::int_type
+output_buffer_t::overflow (int_type c)
+{
+  if (!drain ())
+    return traits_type::eof ();
+
+  if (!traits_type::eq_int_type (c, traits_type::eof ()))
+  {
+    *pptr () = traits_type::to_char_type (c);
+    pbump (1);
+  }
+  return traits_type::not_eof (c);
+}
+
+int
+output_buffer_t::sync ()
+{
+  return drain () ? 0 : -1;
+}
+
+bool
+output_buffer_t::drain ()
+{
+  const char *data = pbase ();
+  size_t length = pptr () - pbase ();
+
+  if (splice_ && length == size_)
+  {
+    while (length)
+    {
+      iovec iov = {const_cast <char *> (data), length};
+      const ssize_t n = vmsplice (fd_, &iov, 1, 0);
+      if (n < 0)
+      {
+        if (EINTR == errno)
+          continue;
+
+        splice_ = false;
+        break;
+      }
+      data += n;
+      length -= n;
+    }
+
+    if (!length)
+    {
+      half_ ^= 1;
+      setp (pages_ + half_ * size_, pages_ + (half_ + 1) * size_);
+      return true;
+    }
+  }
+
+  while (length)
+  {
+    const ssize_t n = write (fd_, data, length);
+    if (n < 0)
+    {
+      if (EINTR == errno)
+        continue;
+
+      setp (pbase (), epptr ());
+      return false;
+    }
+    data += n;
+    length -= n;
+  }
+
+  setp (pbase (), epptr ());
+  return true;
+}
+
+input_buffer_t::input_buffer_t (int fd, std::streambuf *tie)
+: fd_          (fd),
+  tie_         (tie),
+  synchronous_ (false),
+  count_       (CHUNK_COUNT),
+  filled_   (0),
+  consumed_ (0),
+  holding_  (false),
+  end_      (false),
+  stopping_ (false)
+{
+  struct stat st;
+  const bool regular = 0 == fstat (fd, &st) && S_ISREG (st.st_mode);
+  if (regular)
+  {
+    (void) posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (size_t (st.st_size) < CHUNK_SIZE)
+      count_ = 2;
+  }
+  else
+  {
+    synchronous_ = true;
+    count_ = 1;
+  }
+
+  chunks_.reset (new chunk_t[count_]);
+  if (synchronous_)
+    return;
+
+  if (CHUNK_COUNT != count_)
+  {
+    // Handed over to a thread after all if the file grew meanwhile.
+    while (!end_ && filled_ < count_)
+      read_chunk ();
+    if (end_)
+      return;
+  }
+  thread_ = std::thread (&input_buffer_t::fill, this);
+}
+
+input_buffer_t::~input_buffer_t ()
+{
+  {
+    std::lock_guard <std::mutex> lock (mutex_);
+    stopping_ = true;
+  }
+  changed_.notify_all ();
+  if (thread_.joinable ())
+    thread_.join ();
+}
+
+input_buffer_t::int_type
+input_buffer_t::underflow ()
+{
+  if (synchronous_)
+  {
+    pollfd ready = {fd_, POLLIN, 0};
+    if (tie_ && !end_ && 0 == poll (&ready, 1, 0))
+      tie_->pubsync ();
+
+    holding_ = false;
+    consumed_ = filled_;
+    if (!end_)
+      read_chunk ();
+    if (filled_ == consumed_)
+      return traits_type::eof ();
+  }
+
+  std::unique_lock <std::mutex> lock (mutex_);
+  if (holding_)
+  {
+    ++consumed_;
+    holding_ = false;
+    changed_.notify_all ();
+  }
+
+  changed_.wait (lock, [this] { return filled_ != consumed_ || end_; });
+  if (filled_ == consumed_)
+    return traits_type::eof ();
+
+  chunk_t &chunk = chunks_[consumed_ % count_];
+  holding_ = true;
+  setg (chunk.data, chunk.data, chunk.data + chunk.length);
+  return traits_type::to_int_type (*gptr ());
+}
+
+void
+input_buffer_t::fill ()
+{
+  // Only this thread sets end_ from here on.
+  while (!end_)
+  {
+    {
+      std::unique_lock <std::mutex> lock (mutex_);
+      changed_.wait (
+        lock, [this] { return stopping_ || filled_ - consumed_ < count_; }
+      );
+      if (stopping_)
+        return;
+    }
+
+    read_chunk ();
+  }
+}
+
+void
+input_buffer_t::read_chunk ()
+{
+  // The slot is the reader's until published; the consumer is elsewhere.
+  chunk_t &chunk = chunks_[filled_ % count_];
+  ssize_t n;
+  do
+    n = read (fd_, chunk.data, CHUNK_SIZE);
+  while (n < 0 && EINTR == errno);
+
+  std::lock_guard <std::mutex> lock (mutex_);
+  if (n > 0)
+  {
+    chunk.length = n;
+    ++filled_;
+  }
+  else
+  {
+    end_ = true;
+  }
+  changed_.notify_all ();
+}
+
+tape_t::tape_t ()
+: high_ (0)
+{
+  enter (0, 0);
+}
+
+tape_t &
+tape_t::operator = (const tape_t &other)
+{
+  // Taking the page under the cursor copies it, which leaves the original
+  // to its owner again.
+  pages_ = other.pages_;
+  high_ = other.high_;
+  enter (other.page_, other.cell_ - other.page_begin_);
+  return *this;
+}
+
+void
+tape_t::next ()
+{
+  if (++cell_ == page_end_)
+    enter (page_ + 1, 0);
+}
+
+void
+tape_t::prev ()
+{
+  if (cell_ != page_begin_)
+    --cell_;
+  else if (page_)
+    enter (page_ - 1, PAGE_SIZE - 1);
+  else
+    throw std::underflow_error ("slot underflow");
+}
+
+unsigned char
+tape_t::get (size_t slot) const
+{
+  const size_t page = slot / PAGE_SIZE;
+  return page < pages_.size () && pages_[page]
+    ? (*pages_[page])[slot % PAGE_SIZE] : 0;
+}
+
+void
+tape_t::clear (size_t retained)
+{
+  const size_t kept = std::max <size_t> (1, retained / PAGE_SIZE);
+  for (size_t i = 0; i < std::min (high_, pages_.size ()); ++i)
+  {
+    if (i < kept && owned (pages_[i]))
+      pages_[i]->fill (0);
+    else
+      pages_[i].reset ();
+  }
+  if (pages_.size () > kept)
+    pages_.resize (kept);
+
+  high_ = 0;
+  enter (0, 0);
+}
+
+void
+tape_t::enter (size_t page, size_t offset)
+{
+  if (pages_.size () <= page)
+    pages_.resize (page + 1);
+
+  auto &p = pages_[page];
+  if (!p)
+    p = std::make_shared <page_t> ();
+  else if (!owned (p))
+    p = std::make_shared <page_t> (*p);
+
+  page_ = page;
+  page_begin_ = p->data ();
+  page_end_ = page_begin_ + PAGE_SIZE;
+  cell_ = page_begin_ + offset;
+  high_ = std::max (high_, page + 1);
+}
+
+unsigned char &
+tape_t::far (ptrdiff_t offset)
+{
+  // Taking the cell's page and coming back leaves both pages owned, and
+  // the cell in place.
+  const size_t slot = position ();
+  seek (slot + offset);
+  unsigned char &cell = *cell_;
+  seek (slot);
+  return cell;
+}
+
+bool
+tape_t::owned (const std::shared_ptr <page_t> &page)
+{
+  if (page.use_count () > 1)
+    return false;
+
+  // Whoever shared the page last may have read it on another thread; their
+  // release of it has to happen before our writes.
+  std::atomic_thread_fence (std::memory_order_acquire);
+  return true;
+}
+
+context_t::context_t ()
+: operation_count_max_ (DEFAULT_MAX_OPERATIONS),
+  operation_count_     (0)
+{
+}
+
+size_t
+context_t::execute (
+  const program_t &program, std::istream &input, std::ostream &out )
+{
+  return run_fused (program, input, out);
+}
+
+template <typename probe_t>
+size_t
+context_t::execute (
+  const program_t &program, std::istream &input, std::ostream &out,
+  probe_t &probe )
+{
+  return run (
+    program.begin (), program.begin (), program.end (), input, out, probe
+  );
+}
+
+size_t
+context_t::execute (
+  const program_t &program, const segment_plan_t &plan, std::istream &input,
+  std::ostream &out, size_t jobs )
+{
+  if (!plan.parallel () || operation_count_ || tape_.position ())
+    return execute (program, input, out);
+
+  struct outcome_t
+  {
+    bool ok = false;
+    size_t operations = 0;
+    std::string output;
+    std::vector <unsigned char> writes;
+  };
+
+  const auto &segments = plan.segments ();
+  std::vector <outcome_t> outcomes (segments.size ());
+  std::atomic <size_t> next (0);
+  auto work = [&] () {
+    context_t c;
+    c.set_max_operations (operation_count_max_);
+    std::istringstream none;
+    null_probe_t probe;
+    for (size_t i; (i = next++) < segments.size (); )
+    {
+      const auto &segment = segments[i];
+      auto &outcome = outcomes[i];
+      c.reset ();
+      c.tape_.seek (segment.entry);
+      try
+      {
+        std::ostringstream o;
+        outcome.operations = c.run (
+          program.begin (), program.begin () + segment.first,
+          program.begin () + segment.last, none, o, probe
+        );
+        outcome.output = o.str ();
+      }
+      catch (const std::exception &)
+      {
+        continue;
+      }
+
+      for (auto slot : segment.writes)
+        outcome.writes.push_back (c.tape_.get (slot));
+      outcome.ok = true;
+    }
+  };
+
+  std::vector <std::thread> workers;
+  jobs = std::max <size_t> (1, std::min (jobs, segments.size ()));
+  for (size_t i = 1; i < jobs; ++i)
+    workers.emplace_back (work);
+  work ();
+  for (auto &worker : workers)
+    worker.join ();
+
+  // Stitch the tape back together in program order, which also reveals the
+  // values the deferred clears really started from.
+  std::vector <unsigned char> slots (1, 0);
+  size_t operation_count = 0;
+  for (size_t i = 0; i < segments.size (); ++i)
+  {
+    const auto &segment = segments[i];
+    const auto &outcome = outcomes[i];
+    if (!outcome.ok)
+      return execute (program, input, out);
+
+    if (slots.size () <= size_t (segment.high))
+      slots.resize (segment.high + 1, 0);
+
+    operation_count += outcome.operations;
+    for (const auto &clear : segment.clears)
+    {
+      const unsigned char value = slots[clear.slot];
+      operation_count += 2 * ('-' == clear.op ? value : (256 - value) % 256);
+    }
+
+    auto value = begin (outcome.writes);
+    for (auto slot : segment.writes)
+      slots[slot] = *value++;
+  }
+
+  if (operation_count > operation_count_max_)
+    return execute (program, input, out);
+
+  for (const auto &outcome : outcomes)
+    out.write (outcome.output.data (), outcome.output.size ());
+
+  for (size_t slot = 0; slot < slots.size (); ++slot)
+  {
+    if (slots[slot])
+    {
+      tape_.seek (slot);
+      tape_.cell () = slots[slot];
+    }
+  }
+  tape_.seek (plan.exit ());
+  operation_count_ = operation_count;
+  return operation_count;
+}
+
+template <typename probe_t>
+size_t
+context_t::run (
+  code_iterator_t code_begin, code_iterator_t first, code_iterator_t last,
+  std::istream &input, std::ostream &out, probe_t &probe )
+{
+  size_t operation_count_start = operation_count_;
+  for (auto cp = first; cp != last; ++cp)
+  {
+    if (++operation_count_ > operation_count_max_)
+    {
+      // Leaves the context as it was before the instruction, so a resume ()
+      // that lowered the limit can carry on from here.
+      --operation_count_;
+      stopped_ = cp;
+      throw std::runtime_error ("max operations exceeded");
+    }
+
+    probe.step (*cp);
+
+    switch (cp->op)
+    {
+    case '+': increment (); break;
+    case '-': decrement (); break;
+    case '<': prev_slot (); break;
+    case '>': next_slot (); break;
+    case '.': send_out (out); break;
+    case ',': read_in (input); break;
+    case '[': start_loop (&cp, code_begin); break;
+    case ']': end_loop (&cp, code_begin); break;
+    case BREAK_OP:
+      // Stands in for an instruction which would have been counted (and
+      // hit the limit) itself, so checking the limit first is right.
+      --operation_count_;
+      stopped_ = cp;
+      return operation_count_ - operation_count_start;
+    }
+  }
+
+  return operation_count_ - operation_count_start;
+}
+
+size_t
+context_t::run_fused (
+  const program_t &program, std::istream &input, std::ostream &out,
+  size_t first )
+{
+  const size_t operation_count_start = operation_count_;
+  const fused_t *const code = program.fused ().data ();
+  const size_t size = program.fused ().size ();
+  auto finish = [&] (const fused_t &f) {
+    null_probe_t probe;
+    (void) run (
+      program.begin (), program.begin () + f.origin, program.end (), input,
+      out, probe
+    );
+    return operation_count_ - operation_count_start;
+  };
+
+  // The ops of a block past its first follow unchecked.
+  auto rest = [&] (const fused_t &f, size_t *ip) {
+    if (f.jump != *ip + 1)
+    {
+      run_body (code + *ip + 1, code + f.jump, 1, input, out);
+      *ip = f.jump - 1;
+    }
+  };
+
+  for (size_t ip = first; ip < size; ++ip)
+  {
+    // For loops, the cost checked is an iteration's, which is more than
+    // skipping them takes; handing over early is harmless. So is skipping a
+    // loop whose body would leave the tape.
+    const fused_t &f = code[ip];
+    if (operation_count_ + f.cost > operation_count_max_
+      || (f.low < 0 && tape_.position () < size_t (-f.low)
+        && !((REPEAT_OP == f.op || SCALE_OP == f.op) && !tape_.cell ())))
+      return finish (f);
+
+    operation_count_ += f.cost;
+    switch (f.op)
+    {
+    case '+':
+      tape_.at (f.offset) += f.arg;
+      rest (f, &ip);
+      break;
+    case '>':
+      tape_.move (f.arg);
+      rest (f, &ip);
+      break;
+    case '.':
+    case ',':
+      transfer (f, input, out);
+      rest (f, &ip);
+      break;
+    case '[':
+      if (!tape_.cell ())
+        ip = f.jump;
+      break;
+    case ']':
+      if (tape_.cell ())
+        ip = f.jump;
+      break;
+    case REPEAT_OP:
+    case SCALE_OP:
+    {
+      operation_count_ -= f.cost;
+      const unsigned char trips = -tape_.cell () * f.arg;
+      const size_t cost = 1 + trips * f.cost;
+      if (operation_count_ + cost > operation_count_max_)
+        return finish (f);
+
+      operation_count_ += cost;
+      const fused_t *const body = code + ip + 1;
+      const fused_t *const sunk = REPEAT_OP == f.op ? body + f.offset : body;
+      for (unsigned t = 0; t < trips && sunk != body; ++t)
+        run_body (body, sunk, 1, input, out);
+      if (trips)
+        run_body (sunk, code + f.jump, trips, input, out);
+      ip = f.jump - 1;
+      break;
+    }
+    }
+  }
+
+  return operation_count_ - operation_count_start;
+}
+
+void
+context_t::transfer (
+  const fused_t &f, std::istream &input, std::ostream &out )
+{
+  if ('.' == f.op)
+    out.put (tape_.at (f.offset));
+  else if (EOF != input.peek ())
+    tape_.at (f.offset) = input.get ();
+}
+
+size_t
+context_t::resume (
+  const program_t &program, size_t ip, std::istream &input,
+  std::ostream &out, size_t until )
+{
+  null_probe_t probe;
+  stopped_ = program.end ();
+  if (until >= operation_count_max_)
+  {
+    (void) run (
+      program.begin (), program.begin () + ip, program.end (), input, out,
+      probe
+    );
+    return stopped_ - program.begin ();
+  }
+
+  // Stopping at @a until is the operation limit hit on purpose.
+  const size_t max_operations = set_max_operations (until);
+  try
+  {
+    (void) run (
+      program.begin (), program.begin () + ip, program.end (), input, out,
+      probe
+    );
+  }
+  catch (const std::exception &)
+  {
+    operation_count_max_ = max_operations;
+    if (operation_count_ != until || program.end () == stopped_)
+      throw;
+  }
+  operation_count_max_ = max_operations;
+  return stopped_ - program.begin ();
+}
+
+size_t
+context_t::resume (
+  const program_t &program, const std::vector <size_t> &entries, size_t ip,
+  std::istream &input, std::ostream &out, size_t until )
+{
+  // Stepping costs an exception per instruction, but the next entry is at
+  // most the rest of a loop the optimized form runs whole away.
+  while (ip < program.size () && SIZE_MAX == entries[ip]
+    && operation_count_ < until)
+    ip = resume (program, ip, input, out, operation_count_ + 1);
+  if (ip == program.size () || operation_count_ >= until)
+    return ip;
+
+  stopped_ = program.end ();
+  if (until >= operation_count_max_)
+  {
+    (void) run_fused (program, input, out, entries[ip]);
+    return stopped_ - program.begin ();
+  }
+
+  // As in resume (), stopping at @a until is the operation limit hit on
+  // purpose, here by the plain interpreter run_fused () hands over to.
+  const size_t max_operations = set_max_operations (until);
+  try
+  {
+    (void) run_fused (program, input, out, entries[ip]);
+  }
+  catch (const std::exception &)
+  {
+    operation_count_max_ = max_operations;
+    if (operation_count_ != until || program.end () == stopped_)
+      throw;
+  }
+  operation_count_max_ = max_operations;
+  return stopped_ - program.begin ();
+}
+
+void
+context_t::restore (
+  const std::string &cells, size_t position, size_t operations )
+{
+  reset ();
+  for (size_t slot = 0; slot < cells.size (); ++slot)
+  {
+    if (cells[slot])
+    {
+      tape_.seek (slot);
+      tape_.cell () = cells[slot];
+    }
+  }
+  tape_.seek (position);
+  operation_count_ = operations;
+}
+
+size_t
+context_t::set_max_operations (size_t max_operations)
+{
+  std::swap (operation_count_max_, max_operations);
+  return max_operations;
+}
+
+void
+context_t::reset ()
+{
+  tape_.clear (RETAINED_SLOTS);
+  operation_count_ = 0;
+}
+
+void
+context_t::clone (context_t *copy) const
+{
+  copy->tape_ = tape_;
+  copy->operation_count_max_ = operation_count_max_;
+  copy->operation_count_ = operation_count_;
+}
+
+void
+context_t::increment ()
+{
+  ++tape_.cell ();
+}
+
+void
+context_t::decrement () {
+  --tape_.cell ();
+}
+
+void
+context_t::prev_slot ()
+{
+  tape_.prev ();
+}
+
+void
+context_t::next_slot ()
+{
+  tape_.next ();
+}
+
+void
+context_t::send_out (std::ostream &out)
+{
+  out.put (tape_.cell ());
+}
+
+void
+context_t::read_in (std::istream &input)
+{
+  if (EOF != input.peek ())
+    tape_.cell () = input.get ();
+}
+
+void
+context_t::start_loop (code_iterator_t *it, code_iterator_t code_begin)
+{
+  // Skipping the loop lands on the matching ']', which the caller steps past.
+  if (!tape_.cell ())
+    *it = code_begin + (*it)->jump;
+}
+
+void
+context_t::end_loop (code_iterator_t *it, code_iterator_t code_begin)
+{
+  // Repeating the loop lands on the matching '[', which the caller steps
+  // past, so the condition is only tested here.
+  if (tape_.cell ())
+    *it = code_begin + (*it)->jump;
+}
+
+namespace
+{
+
+/// What the command line asks brainfck to do. Each mode but the first two is
+/// selected by the flag of the same name.
+enum run_mode_t
+{
+  /// Run a HackerRank style job read from stdin.
+  JOB_MODE,
+
+  /// Run PROGRAM as a filter from stdin to stdout.
+  STREAM_MODE,
+
+  INPUTS_MODE,
+  ESTIMATE_MODE,
+  PROFILE_MODE,
+  TRIPS_MODE,
+  DEBUG_MODE,
+  RECORD_MODE,
+  REPLAY_MODE,
+  COMPILE_MODE,
+  BENCH_MODE,
+  BENCH_PARSE_MODE,
+  SERVE_MODE
+};
+
+/// Command line flags, as bits of a set.
+enum flag_t
+{
+  INPUTS_FLAG = 1 << 0,
+  OUTPUT_DIR_FLAG = 1 << 1,
+  PREFIX_FLAG = 1 << 2,
+  JOBS_FLAG = 1 << 3,
+  MAX_OPERATIONS_FLAG = 1 << 4,
+  SEGMENTS_FLAG = 1 << 5,
+  ESTIMATE_FLAG = 1 << 6,
+  DEBUG_FLAG = 1 << 7,
+  RECORD_FLAG = 1 << 8,
+  REPLAY_FLAG = 1 << 9,
+  COMPILE_FLAG = 1 << 10,
+  PROFILE_FLAG = 1 << 11,
+  PROFILE_INTERVAL_FLAG = 1 << 12,
+  TRIPS_FLAG = 1 << 13,
+  SERVE_FLAG = 1 << 14,
+  CACHE_FLAG = 1 << 15,
+  BENCH_FLAG = 1 << 16,
+  BENCH_PARSE_FLAG = 1 << 17,
+  REPEAT_FLAG = 1 << 18,
+  JSON_FLAG = 1 << 19,
+  BASELINE_FLAG = 1 << 20,
+  THRESHOLD_FLAG = 1 << 21,
+  ENGINE_FLAG = 1 << 22
+};
+
+/// Command line settings.
+struct options_t
+{
+  run_mode_t mode = JOB_MODE;
+
+  /// Operation limit per run, 0 for none.
+  size_t max_operations = DEFAULT_MAX_OPERATIONS;
+
+  /// Number of worker threads, 0 to use one per core.
+  size_t jobs = 0;
+
+  /// Run independent top-level segments of the program concurrently.
+  bool segments = false;
+
+  /// HackerRank style job to debug interactively.
+  std::string debug;
+
+  /// File receiving a recording of the program's run.
+  std::string record;
+
+  /// Recording to debug the program's run from.
+  std::string replay;
+
+  /// File receiving the compiled program.
+  std::string compile;
+
+  /// File receiving folded stacks from the sampling profiler.
+  std::string profile;
+
+  /// CPU time between profiler samples.
+  size_t profile_interval = 1000;
+
+  /// File receiving the loop trip count histograms.
+  std::string trips;
+
+  /// Directory or tar archive holding one input per file.
+  std::string inputs;
+
+  /// Directory receiving one output file per input.
+  std::string output_dir;
+
+  /// Path to the BF source.
+  std::string program;
+
+  /// Path to BF source run once before PROGRAM, whose final state each
+  /// input's run starts from.
+  std::string prefix;
+
+  /// Code lines in the generated job that the parsers are timed on, or 0 to
+  /// not benchmark them.
+  size_t bench_parse = 0;
+
+  /// Runs per engine and workload; the fastest is reported.
+  size_t repeat = 5;
+
+  /// Engines to benchmark, all of them if empty.
+  std::vector <std::string> engines;
+
+  /// File receiving the benchmark results as JSON.
+  std::string json;
+
+  /// Benchmark results (as JSON) to compare against.
+  std::string baseline;
+
+  /// Slowdown over the baseline tolerated as noise, in percent.
+  double threshold = 10;
+
+  /// Unix domain socket to serve jobs on.
+  std::string serve;
+
+  /// Compiled programs the server keeps, 0 for none.
+  size_t cache = 0;
+
+  /// Positional arguments.
+  std::vector <std::string> arguments;
+};
+
+/// What a mode takes from the command line.
+struct mode_rule_t
+{
+  run_mode_t mode;
+
+  /// The flag selecting the mode, 0 for none.
+  unsigned flag;
+
+  /// The other flags it accepts.
+  unsigned allowed;
+
+  /// Positional arguments it takes.
+  size_t min_arguments;
+  size_t max_arguments;
+};
+
+/// A HackerRank style job: the program's input, then its code.
+struct job_t
+{
+  std::string input;
+  std::vector <char> code;
+};
+
+/// Hardware performance counters for the calling thread, and the threads it
+/// starts afterwards (once they have exited), read with perf_event_open. Any
+/// counter the kernel (or the container) won't provide is simply reported as
+/// unavailable.
+class counters_t
+{
+public:
+  enum counter_t
+  {
+    CYCLES,
+    INSTRUCTIONS,
+    BRANCH_MISSES,
+    L1D_MISSES,
+    COUNTER_COUNT
+  };
+
+  counters_t ();
+
+  ~counters_t ();
+
+  bool
+  available (counter_t counter) const { return fds_[counter] >= 0; }
+
+  /// Zeroes and starts the counters.
+  void
+  start ();
+
+  /// Stops the counters and reads them, scaled up if the kernel had to
+  /// multiplex them.
+  void
+  stop ();
+
+  uint64_t
+  value (counter_t counter) const { return values_[counter]; }
+
+private:
+  int fds_[COUNTER_COUNT];
+  uint64_t values_[COUNTER_COUNT];
+
+  counters_t (const counters_t &) = delete;
+  counters_t & operator = (const counters_t &) = delete;
+};
+
+/// Fastest run of one engine on one workload.
+struct bench_result_t
+{
+  std::string workload;
+  std::string engine;
+  size_t operations = 0;
+  uint64_t nanoseconds = 0;
+
+  /// Hardware counters, indexed by counters_t::counter_t; absent ones are
+  /// left negative.
+  double counters[counters_t::COUNTER_COUNT] = {-1, -1, -1, -1};
+};
+
+/// An execution strategy the benchmark can time.
+struct engine_t
+{
+  const char *name;
+
+  size_t
+  (*execute) (
+    context_t &c, const program_t &program, const segment_plan_t &plan,
+    std::istream &input, std::ostream &out, size_t jobs
+  );
+};
+
+/// One input of a multi-input run.
+struct input_t
+{
+  std::string name;
+
+  /// File to load the input from, if @a data hasn't been filled in already.
+  std::string path;
+
+  std::string data;
+};
+
+/// Outcome of running the program against one input.
+struct result_t
+{
+  std::string status;
+  size_t operations = 0;
+  std::chrono::microseconds elapsed {0};
+
+  /// The program's output, unless it went to the output directory.
+  std::string output;
+};
+
+/// Bounded queue handing values from any number of producers to a single
+/// consumer, strictly in sequence order, without locks. Each sequence number
+/// owns slot `sequence % capacity`; the slot's counter says whether it is
+/// free for that number (2 * sequence) or holds it (2 * sequence + 1).
+/// Producers finishing early wait (spinning, then sleeping) for the consumer
+/// to free their slot, which bounds the memory held by finished values.
+template <typename value_t>
+class ordered_queue_t
+{
+public:
+  explicit ordered_queue_t (size_t capacity);
+
+  /// Stores @a value as number @a sequence.
+  void
+  publish (size_t sequence, value_t value);
+
+  /// Waits for and removes number @a sequence; the consumer has to take the
+  /// numbers in order, from 0.
+  value_t
+  take (size_t sequence);
+
+private:
+  struct slot_t
+  {
+    std::atomic <size_t> state;
+    value_t value;
+  };
+
+  /// Waits for @a slot to reach @a state.
+  static void
+  await (const slot_t &slot, size_t state);
+
+  size_t capacity_;
+  std::unique_ptr <slot_t []> slots_;
+};
+
+} // anonymous namespace
+
+static const engine_t ENGINES[] =
+{
+  {
+    "interpreter",
+    [] (
+      context_t &c, const program_t &program, const segment_plan_t &,
+      std::istream &input, std::ostream &out, size_t )
+    {
+      return c.execute (program, input, out);
+    }
+  },
+  {
+    "reference",
+    [] (
+      context_t &c, const program_t &program, const segment_plan_t &,
+      std::istream &input, std::ostream &out, size_t )
+    {
+      null_probe_t probe;
+      return c.execute (program, input, out, probe);
+    }
+  },
+  {
+    "segments",
+    [] (
+      context_t &c, const program_t &program, const segment_plan_t &plan,
+      std::istream &input, std::ostream &out, size_t jobs )
+    {
+      return c.execute (program, plan, input, out, jobs);
+    }
+  },
+};
+
+/// Reads a HackerRank style job: the input and code lengths, the input
+/// terminated by '$', then the code lines. This is the reference for
+/// parse_job (), kept to benchmark it against.
+/// @throw std::runtime_error if the job doesn't match its declared lengths.
+static void
+read_job (std::istream &in, job_t *job)
+{
+  size_t input_count = 0, line_count = 0;
+  in >> input_count >> line_count >> std::ws;
+
+  std::stringstream input;
+  size_t actual_input = read_until (in, input, '$');
+  if (actual_input != input_count)
+  {
+    std::ostringstream error;
+    error << "Invalid input, expected " << input_count << " characters, "
+      << "received " << actual_input;
+    throw std::runtime_error (error.str ());
+  }
+  job->input = input.str ();
+
+  in >> std::ws;
+
+  size_t lines = 0;
+  job->code.clear ();
+  for (size_t i = 0; i < line_count; ++i)
+  {
+    std::string line;
+    if (!getline (in, line))
+      break;
+
+    std::copy (begin (line), end (line), std::back_inserter (job->code));
+    ++lines;
+  }
+
+  if (lines != line_count)
+  {
+    std::ostringstream error;
+    error << "Expected " << line_count << " lines, received " << lines;
+    throw std::runtime_error (error.str ());
+  }
+}
+
+/// Parses a HackerRank style job held in [@a first, @a last). Accepts and
+/// rejects exactly what read_job () does, including its stream quirks (a
+/// count that doesn't parse reads as 0 and ends the job, as does reaching the
+/// end of the data), without paying for formatted extraction and per
+/// character stream access.
+/// @throw std::runtime_error if the job doesn't match its declared lengths.
+static void
+parse_job (const char *first, const char *last, job_t *job)
+{
+  // Mirrors the stream state: false once an extraction failed or hit the end.
+  bool good = first != last;
+  auto space = [] (char c) { return ' ' == c || ('\t' <= c && c <= '\r'); };
+  auto skip_space = [&] () {
+    while (first != last && space (*first))
+      ++first;
+    good = first != last;
+  };
+  auto number = [&] () -> size_t {
+    if (!good)
+      return 0;
+
+    skip_space ();
+    const bool negative = good && '-' == *first;
+    if (good && ('+' == *first || '-' == *first))
+      ++first;
+    if (first == last || *first < '0' || '9' < *first)
+    {
+      good = false;
+      return 0;
+    }
+
+    size_t n = 0;
+    bool overflow = false;
+    for (; first != last && '0' <= *first && *first <= '9'; ++first)
+    {
+      const size_t digit = *first - '0';
+      overflow = overflow || n > (SIZE_MAX - digit) / 10;
+      n = n * 10 + digit;
+    }
+
+    good = !overflow && first != last;
+    return overflow ? SIZE_MAX : negative ? -n : n;
+  };
+
+  const size_t input_count = number ();
+  const size_t line_count = number ();
+  if (good)
+    skip_space ();
+
+  job->input.clear ();
+  if (good)
+  {
+    const char *dollar =
+      static_cast <const char *> (std::memchr (first, '$', last - first));
+    job->input.assign (first, dollar ? dollar : last);
+    first = dollar ? dollar + 1 : last;
+    good = dollar;
+  }
+
+  if (job->input.size () != input_count)
+  {
+    std::ostringstream error;
+    error << "Invalid input, expected " << input_count << " characters, "
+      << "received " << job->input.size ();
+    throw std::runtime_error (error.str ());
+  }
+
+  if (good)
+    skip_space ();
+
+  size_t lines = 0;
+  job->code.clear ();
+  for (; lines < line_count && good && first != last; ++lines)
+  {
+    const char *newline =
+      static_cast <const char *> (std::memchr (first, '\n', last - first));
+    job->code.insert (job->code.end (), first, newline ? newline : last);
+    first = newline ? newline + 1 : last;
+    good = newline;
+  }
+
+  if (lines != line_count)
+  {
+    std::ostringstream error;
+    error << "Expected " << line_count << " lines, received " << lines;
+    throw std::runtime_error (error.str ());
+  }
+}
+
+/// @return The operation limit to set on contexts.
+static size_t
+operation_limit (const options_t &options)
+{
+  return options.max_operations ? options.max_operations : SIZE_MAX;
+}
+
+static void
+usage (std::ostream &out)
+{
+  out << "usage: brainfck [--segments] [--jobs N] [--max-operations N]\n"
+    << "       brainfck [--profile FILE [--profile-interval USEC]]"
+    << " [--max-operations N]\n"
+    << "       brainfck --trips FILE [--max-operations N]\n"
+    << "       brainfck --estimate\n"
+    << "       brainfck [--max-operations N] PROGRAM\n"
+    << "       brainfck [--max-operations N] --debug JOB\n"
+    << "       brainfck [--max-operations N] --record LOG PROGRAM\n"
+    << "       brainfck [--max-operations N] --replay LOG PROGRAM\n"
+    << "       brainfck --compile FILE PROGRAM\n"
+    << "       brainfck [--jobs N] [--max-operations N] [--prefix FILE]"
+    << " --inputs PATH\n"
+    << "                [--output-dir DIR] PROGRAM\n"
+    << "       brainfck --bench [--repeat N] [--engine NAME]... [--jobs N]\n"
+    << "                [--max-operations N] [--json FILE]\n"
+    << "                [--baseline FILE [--threshold PCT]] JOB...\n"
+    << "       brainfck --bench-parse LINES [--repeat N]\n"
+    << "       brainfck --serve SOCKET [--cache N] [--jobs N]"
+    << " [--max-operations N]\n"
+    << "\n"
+    << "Without arguments, reads a HackerRank style job from stdin. Given\n"
+    << "just PROGRAM, runs it as a filter from stdin to stdout.\n"
+    << "\n"
+    << "  --inputs PATH          directory or tar archive of inputs; PROGRAM\n"
+    << "                         is compiled once and run against each\n"
+    << "  --output-dir DIR       receives <input>.out for each input, instead\n"
+    << "                         of stdout\n"
+    << "  --prefix FILE          BF code run once, without input, before\n"
+    << "                         PROGRAM; each input's run forks its state\n"
+    << "  --segments             run independent parts of the program\n"
+    << "                         concurrently\n"
+    << "  --estimate             print upper bounds on the operations and\n"
+    << "                         tape cells the job needs, without running it\n"
+    << "  --debug JOB            debug the HackerRank style job in JOB,\n"
+    << "                         reading commands from stdin (try help);\n"
+    << "                         '#' in the code marks a breakpoint\n"
+    << "  --record LOG           run PROGRAM as a filter, recording its input\n"
+    << "                         and periodic checkpoints in LOG\n"
+    << "  --replay LOG           debug the run of PROGRAM recorded in LOG,\n"
+    << "                         reading commands from stdin\n"
+    << "  --compile FILE         write PROGRAM compiled to FILE, which runs\n"
+    << "                         in its place, without compiling it again\n"
+    << "  --profile FILE         sample the running program, writing folded\n"
+    << "                         stacks (loops as frames) to FILE\n"
+    << "  --profile-interval USEC\n"
+    << "                         CPU time between samples (default: 1000)\n"
+    << "  --trips FILE           write a JSON histogram of the iterations per\n"
+    << "                         entry of each loop to FILE\n"
+    << "                         (--profile and --trips run the unoptimized\n"
+    << "                         interpreter, several times slower)\n"
+    << "  --bench                time each engine on each HackerRank style\n"
+    << "                         JOB file, with hardware counters when the\n"
+    << "                         kernel provides them\n"
+    << "  --repeat N             runs per benchmark, the fastest is kept\n"
+    << "                         (default: 5)\n"
+    << "  --engine NAME          benchmark only this engine (interpreter,\n"
+    << "                         reference, segments)\n"
+    << "  --bench-parse LINES    time the job parser on a generated job of\n"
+    << "                         LINES code lines\n"
+    << "  --json FILE            write the benchmark results to FILE\n"
+    << "  --baseline FILE        compare with results saved by --json, and\n"
+    << "                         exit with 2 if anything got slower\n"
+    << "  --threshold PCT        slowdown tolerated as noise (default: 10)\n"
+    << "  --serve SOCKET         serve jobs on a Unix domain socket, one per\n"
+    << "                         connection; the response is a status line\n"
+    << "                         (ok, or error: ...) and the output\n"
+    << "  --cache N              keep the N most recently used programs\n"
+    << "                         compiled, whatever their comments and layout\n"
+    << "  --jobs N               worker threads (default: one per core)\n"
+    << "  --max-operations N     per run operation limit, 0 for none\n"
+    << "                         (default: " << DEFAULT_MAX_OPERATIONS << ")\n";
+}
+
+/// Rules for each mode, in run_mode_t order.
+static const mode_rule_t MODE_RULES[] =
+{
+  {JOB_MODE, 0, SEGMENTS_FLAG | JOBS_FLAG | MAX_OPERATIONS_FLAG, 0, 0},
+  {STREAM_MODE, 0, MAX_OPERATIONS_FLAG, 1, 1},
+  {
+    INPUTS_MODE, INPUTS_FLAG,
+    OUTPUT_DIR_FLAG | PREFIX_FLAG | JOBS_FLAG | MAX_OPERATIONS_FLAG, 1, 1
+  },
+  {ESTIMATE_MODE, ESTIMATE_FLAG, 0, 0, 0},
+  {
+    PROFILE_MODE, PROFILE_FLAG, PROFILE_INTERVAL_FLAG | MAX_OPERATIONS_FLAG,
+    0, 0
+  },
+  {TRIPS_MODE, TRIPS_FLAG, MAX_OPERATIONS_FLAG, 0, 0},
+  {DEBUG_MODE, DEBUG_FLAG, MAX_OPERATIONS_FLAG, 0, 0},
+  {RECORD_MODE, RECORD_FLAG, MAX_OPERATIONS_FLAG, 1, 1},
+  {REPLAY_MODE, REPLAY_FLAG, MAX_OPERATIONS_FLAG, 1, 1},
+  {COMPILE_MODE, COMPILE_FLAG, 0, 1, 1},
+  {
+    BENCH_MODE, BENCH_FLAG,
+    REPEAT_FLAG | ENGINE_FLAG | JOBS_FLAG | MAX_OPERATIONS_FLAG | JSON_FLAG
+      | BASELINE_FLAG | THRESHOLD_FLAG,
+    1, SIZE_MAX
+  },
+  {BENCH_PARSE_MODE, BENCH_PARSE_FLAG, REPEAT_FLAG, 0, 0},
+  {
+    SERVE_MODE, SERVE_FLAG, CACHE_FLAG | JOBS_FLAG | MAX_OPERATIONS_FLAG, 0, 0
+  },
+};
+
+/// Parses the command line into @a options, selecting the mode by the flags
+/// given, and checks it against the mode's rule.
+/// @return false, after reporting the problem, if the command line is
+/// invalid.
+static bool
+parse_options (int argc, char **argv, options_t *options)
+{
+  unsigned given = 0;
+  for (int i = 1; i < argc; ++i)
+  {
+    const std::string arg = argv[i];
+    auto seen = [&] (unsigned flag) {
+      given |= flag;
+      return true;
+    };
+    auto value = [&] () -> const char * {
+      return i + 1 < argc ? argv[++i] : nullptr;
+    };
+    auto text = [&] (std::string *s) {
+      const char *v = value ();
+      if (v)
+        *s = v;
+      return nullptr != v;
+    };
+    auto number = [&] (size_t *n) {
+      const char *v = value ();
+      char *e = nullptr;
+      if (v)
+        *n = std::strtoul (v, &e, 10);
+      return v && *v && !*e;
+    };
+
+    bool ok = true;
+    if ("--inputs" == arg)
+      ok = seen (INPUTS_FLAG) && text (&options->inputs);
+    else if ("--output-dir" == arg)
+      ok = seen (OUTPUT_DIR_FLAG) && text (&options->output_dir);
+    else if ("--prefix" == arg)
+      ok = seen (PREFIX_FLAG) && text (&options->prefix);
+    else if ("--jobs" == arg)
+      ok = seen (JOBS_FLAG) && number (&options->jobs);
+    else if ("--max-operations" == arg)
+      ok = seen (MAX_OPERATIONS_FLAG) && number (&options->max_operations);
+    else if ("--segments" == arg)
+      options->segments = seen (SEGMENTS_FLAG);
+    else if ("--estimate" == arg)
+      seen (ESTIMATE_FLAG);
+    else if ("--debug" == arg)
+      ok = seen (DEBUG_FLAG) && text (&options->debug);
+    else if ("--record" == arg)
+      ok = seen (RECORD_FLAG) && text (&options->record);
+    else if ("--replay" == arg)
+      ok = seen (REPLAY_FLAG) && text (&options->replay);
+    else if ("--compile" == arg)
+      ok = seen (COMPILE_FLAG) && text (&options->compile);
+    else if ("--profile" == arg)
+      ok = seen (PROFILE_FLAG) && text (&options->profile);
+    else if ("--profile-interval" == arg)
+    {
+      ok = seen (PROFILE_INTERVAL_FLAG) && number (&options->profile_interval)
+        && options->profile_interval;
+    }
+    else if ("--trips" == arg)
+      ok = seen (TRIPS_FLAG) && text (&options->trips);
+    else if ("--serve" == arg)
+      ok = seen (SERVE_FLAG) && text (&options->serve);
+    else if ("--cache" == arg)
+      ok = seen (CACHE_FLAG) && number (&options->cache);
+    else if ("--bench" == arg)
+      seen (BENCH_FLAG);
+    else if ("--bench-parse" == arg)
+    {
+      ok = seen (BENCH_PARSE_FLAG) && number (&options->bench_parse)
+        && options->bench_parse;
+    }
+    else if ("--repeat" == arg)
+      ok = seen (REPEAT_FLAG) && number (&options->repeat) && options->repeat;
+    else if ("--json" == arg)
+      ok = seen (JSON_FLAG) && text (&options->json);
+    else if ("--baseline" == arg)
+      ok = seen (BASELINE_FLAG) && text (&options->baseline);
+    else if ("--threshold" == arg)
+    {
+      const char *v = seen (THRESHOLD_FLAG) ? value () : nullptr;
+      char *e = nullptr;
+      if (v)
+        options->threshold = std::strtod (v, &e);
+      ok = v && *v && !*e && options->threshold >= 0;
+    }
+    else if ("--engine" == arg)
+    {
+      std::string name;
+      ok = seen (ENGINE_FLAG) && text (&name) && std::any_of (
+        std::begin (ENGINES), std::end (ENGINES),
+        [&] (const engine_t &engine) { return name == engine.name; }
+      );
+      options->engines.push_back (name);
+    }
+    else if ("--help" == arg)
+    {
+      usage (std::cout);
+      std::exit (0);
+    }
+    else if (arg.empty () || '-' == arg[0])
+      ok = false;
+    else
+      options->arguments.push_back (arg);
+
+    if (!ok)
+    {
+      std::cerr << "Invalid argument: " << arg << std::endl;
+      usage (std::cerr);
+      return false;
+    }
+  }
+
+  // A mode's flag selects it; without one, PROGRAM is run as a filter.
+  const mode_rule_t *rule = nullptr;
+  for (const auto &candidate : MODE_RULES)
+  {
+    if (candidate.flag & given)
+    {
+      if (rule)
+      {
+        usage (std::cerr);
+        return false;
+      }
+      rule = &candidate;
+    }
+  }
+  if (!rule)
+    rule = &MODE_RULES[options->arguments.empty () ? JOB_MODE : STREAM_MODE];
+
+  const size_t arguments = options->arguments.size ();
+  if (given & ~(rule->flag | rule->allowed)
+    || arguments < rule->min_arguments || arguments > rule->max_arguments)
+  {
+    usage (std::cerr);
+    return false;
+  }
+
+  options->mode = rule->mode;
+  if (1 == rule->max_arguments)
+    options->program = options->arguments.front ();
+
+  return true;
+}
+
+/// Lists the regular files in the directory at @a path, sorted by name.
+/// @throw std::runtime_error if the directory can't be read.
+static void
+list_directory (const std::string &path, std::vector <input_t> *inputs)
+{
+  DIR *dir = opendir (path.c_str ());
+  if (!dir)
+    throw std::runtime_error ("unable to open " + path);
+
+  while (const dirent *entry = readdir (dir))
+  {
+    input_t input;
+    input.name = entry->d_name;
+    input.path = path + "/" + input.name;
+
+    struct stat st;
+    if (0 == stat (input.path.c_str (), &st) && S_ISREG (st.st_mode))
+      inputs->push_back (std::move (input));
+  }
+  closedir (dir);
+
+  std::sort (
+    begin (*inputs), end (*inputs),
+    [] (const input_t &a, const input_t &b) { return a.name < b.name; }
+  );
+}
+
+/// Unpacks the regular files of the (uncompressed, ustar) archive at @a path.
+/// Member names are flattened, '/' becoming '_'.
+/// @throw std::runtime_error if the archive can't be read or is malformed.
+static void
+list_archive (const std::string &path, std::vector <input_t> *inputs)
+{
+  static const size_t BLOCK = 512;
+
+  std::string archive;
+  read_file (path, &archive);
+
+  for (size_t at = 0; at + BLOCK <= archive.size (); )
+  {
+    const char *header = archive.data () + at;
+    if (!header[0])
+      break;
+
+    const std::string size_field (header + 124, 12);
+    char *e = nullptr;
+    const size_t size = std::strtoul (size_field.c_str (), &e, 8);
+    if (e == size_field.c_str () || at + BLOCK + size > archive.size ())
+      throw std::runtime_error ("malformed archive " + path);
+
+    const char type = header[156];
+    if ('0' == type || '\0' == type)
+    {
+      input_t input;
+      input.name.assign (header, strnlen (header, 100));
+      std::replace (begin (input.name), end (input.name), '/', '_');
+      input.data.assign (header + BLOCK, size);
+      inputs->push_back (std::move (input));
+    }
+
+    at += BLOCK + (size + BLOCK - 1) / BLOCK * BLOCK;
+  }
+}
+
+/// @return The number of worker threads to use.
+static size_t
+jobs_wanted (const options_t &options)
+{
+  return options.jobs ? options.jobs : std::thread::hardware_concurrency ();
+}
+
+template <typename value_t>
+ordered_queue_t <value_t>::ordered_queue_t (size_t capacity)
+: capacity_ (capacity),
+  slots_    (new slot_t[capacity])
+{
+  for (size_t i = 0; i < capacity; ++i)
+    slots_[i].state = 2 * i;
+}
+
+template <typename value_t>
+void
+ordered_queue_t <value_t>::publish (size_t sequence, value_t value)
+{
+  slot_t &slot = slots_[sequence % capacity_];
+  await (slot, 2 * sequence);
+  slot.value = std::move (value);
+  slot.state.store (2 * sequence + 1, std::memory_order_release);
+}
+
+template <typename value_t>
+value_t
+ordered_queue_t <value_t>::take (size_t sequence)
+{
+  slot_t &slot = slots_[sequence % capacity_];
+  await (slot, 2 * sequence + 1);
+  value_t value = std::move (slot.value);
+  slot.state.store (2 * (sequence + capacity_), std::memory_order_release);
+  return value;
+}
+
+template <typename value_t>
+void
+ordered_queue_t <value_t>::await (const slot_t &slot, size_t state)
+{
+  for (unsigned spins = 0;
+    slot.state.load (std::memory_order_acquire) != state; ++spins)
+  {
+    if (spins < 64)
+      std::this_thread::yield ();
+    else
+      std::this_thread::sleep_for (
+        std::chrono::microseconds (std::min (spins - 63, 1000u))
+      );
+  }
+}
+
+/// Runs @a program against the inputs handed out by @a next, until there are
+/// none left, publishing each outcome to @a results. Each run starts from a
+/// clone of @a origin, with @a origin_output already written, as if picking
+/// up where @a origin left off.
+static void
+run_inputs (
+  const program_t &program, const options_t &options,
+  const context_t &origin, const std::string &origin_output,
+  std::vector <input_t> *inputs, ordered_queue_t <result_t> *results,
+  std::atomic <size_t> *next )
+{
+  context_t c;
+
+  for (size_t i; (i = (*next)++) < inputs->size (); )
+  {
+    input_t &input = (*inputs)[i];
+    result_t result;
+    std::ostringstream out;
+    bool ran = false;
+    const auto start = std::chrono::steady_clock::now ();
+    try
+    {
+      // Files stream in as the program runs; archive members are in memory.
+      struct file_t
+      {
+        int fd;
+        ~file_t () { if (fd >= 0) close (fd); }
+      } file {-1};
+      std::unique_ptr <input_buffer_t> buffer;
+      std::istringstream memory (input.data);
+      if (!input.path.empty ())
+      {
+        file.fd = open (input.path.c_str (), O_RDONLY | O_CLOEXEC);
+        if (file.fd < 0)
+          throw std::runtime_error ("unable to open " + input.path);
+        buffer.reset (new input_buffer_t (file.fd));
+      }
+
+      std::istream in (
+        buffer ? static_cast <std::streambuf *> (buffer.get ())
+          : memory.rdbuf ()
+      );
+      out << origin_output;
+      origin.clone (&c);
+      ran = true;
+      (void) c.execute (program, in, out);
+      result.status = "ok";
+    }
+    catch (const std::exception &e)
+    {
+      result.status = std::string ("error: ") + e.what ();
+    }
+
+    // A run that failed still reports the operations it got through and the
+    // output it produced up to there.
+    if (ran)
+    {
+      result.operations = c.operations ();
+      if (options.output_dir.empty ())
+      {
+        result.output = out.str ();
+      }
+      else
+      {
+        const std::string path =
+          options.output_dir + "/" + input.name + ".out";
+        std::ofstream file (path, std::ios::out | std::ios::binary);
+        if (!(file << out.str ()))
+          result.status = "error: unable to write " + path;
+      }
+    }
+    result.elapsed = std::chrono::duration_cast <std::chrono::microseconds> (
+      std::chrono::steady_clock::now () - start
+    );
+
+    input.data.clear ();
+    input.data.shrink_to_fit ();
+    results->publish (i, std::move (result));
+  }
+}
+
+namespace
+{
+
+/// Fixed buffers shared by the server's connections, one per connection in
+/// flight. io_uring registers them with the kernel once, so reads and writes
+/// skip mapping user memory on every request.
+class buffer_pool_t
+{
+public:
+  /// @throw std::runtime_error if the buffers can't be allocated.
+  buffer_pool_t (size_t count, size_t size);
+
+  ~buffer_pool_t ();
+
+  /// @return The index of a free buffer, or -1 if there is none.
+  int
+  acquire ();
+
+  void
+  release (int index) { free_.push_back (index); }
+
+  char *
+  data (int index) const { return memory_ + index * size_; }
+
+  size_t
+  size () const { return size_; }
+
+  size_t
+  count () const { return count_; }
+
+  bool
+  empty () const { return free_.empty (); }
+
+private:
+  size_t count_;
+  size_t size_;
+  char *memory_;
+  std::vector <int> free_;
+
+  buffer_pool_t (const buffer_pool_t &) = delete;
+  buffer_pool_t & operator = (const buffer_pool_t &) = delete;
+};
+
+/// An asynchronous operation handed to an event loop.
+struct io_request_t
+{
+  enum op_t
+  {
+    ACCEPT,
+    READ,
+    WRITE
+  };
+
+  op_t op;
+  int fd;
+
+  /// For READ and WRITE, the data, within pool buffer @a buffer.
+  char *data;
+  size_t length;
+  int buffer;
+
+  /// Handed back with the completion.
+  void *user;
+};
+
+struct io_completion_t
+{
+  void *user;
+
+  /// Bytes transferred, or the accepted descriptor; -errno on failure.
+  ssize_t result;
+};
+
+/// Completion based I/O: requests are queued, then issued together, and
+/// their results collected as they finish.
+class event_loop_t
+{
+public:
+  virtual
+  ~event_loop_t () {}
+
+  virtual const char *
+  name () const = 0;
+
+  /// Queues @a request; nothing is issued until wait ().
+  virtual void
+  submit (const io_request_t &request) = 0;
+
+  /// Issues the queued requests and blocks until at least one completes.
+  virtual void
+  wait (std::vector <io_completion_t> *completions) = 0;
+};
+
+/// io_uring, driven through the raw system calls: each wait () submits every
+/// queued request with a single io_uring_enter and reaps all completions.
+class uring_loop_t : public event_loop_t
+{
+public:
+  /// @throw std::runtime_error if io_uring is unavailable or lacks an
+  /// operation the server needs.
+  uring_loop_t (buffer_pool_t *pool, unsigned entries);
+
+  ~uring_loop_t ();
+
+  const char *
+  name () const override { return "io_uring"; }
+
+  void
+  submit (const io_request_t &request) override;
+
+  void
+  wait (std::vector <io_completion_t> *completions) override;
+
+private:
+  /// Hands queued entries to the kernel, waiting for @a min_complete
+  /// completions.
+  void
+  enter (unsigned min_complete);
+
+  /// Unmaps the rings and closes the instance.
+  void
+  release ();
+
+  int fd_;
+  bool fixed_;
+  unsigned queued_;
+
+  void *sq_ring_;
+  size_t sq_ring_size_;
+  void *cq_ring_;
+  size_t cq_ring_size_;
+  io_uring_sqe *sqes_;
+  size_t sqes_size_;
+
+  unsigned *sq_head_, *sq_tail_, *sq_mask_, *sq_entries_, *sq_array_;
+  unsigned *cq_head_, *cq_tail_, *cq_mask_;
+  io_uring_cqe *cqes_;
+
+  uring_loop_t (const uring_loop_t &) = delete;
+  uring_loop_t & operator = (const uring_loop_t &) = delete;
+};
+
+/// Emulates completions with epoll: each request is attempted right away on
+/// a non-blocking descriptor, and only parked until readiness if it would
+/// block.
+class epoll_loop_t : public event_loop_t
+{
+public:
+  /// @throw std::runtime_error if the epoll instance can't be created.
+  epoll_loop_t ();
+
+  ~epoll_loop_t ();
+
+  const char *
+  name () const override { return "epoll"; }
+
+  void
+  submit (const io_request_t &request) override;
+
+  void
+  wait (std::vector <io_completion_t> *completions) override;
+
+private:
+  /// Performs @a request.
+  /// @return false if it would block.
+  bool
+  attempt (const io_request_t &request, io_completion_t *completion);
+
+  int fd_;
+  std::vector <io_request_t> queued_;
+
+  /// Requests waiting for their descriptor to become ready, by descriptor.
+  std::map <int, io_request_t> parked_;
+
+  epoll_loop_t (const epoll_loop_t &) = delete;
+  epoll_loop_t & operator = (const epoll_loop_t &) = delete;
+};
+
+/// One client of the server: a job read in full, then its response written
+/// back.
+struct connection_t
+{
+  int fd;
+  int buffer;
+  std::string request;
+  std::string response;
+  size_t written = 0;
+};
+
+/// Compiled programs, keyed by the hash of their canonical form (see
+/// canonical ()), so that copies of a program differing only in comments and
+/// layout are compiled once. Past its capacity, the least recently used
+/// program is evicted. Safe to share between threads.
+class program_cache_t
+{
+public:
+  explicit program_cache_t (size_t capacity) : capacity_ (capacity) {}
+
+  /// @return The program compiled from @a code, which is compiled unless an
+  /// equivalent one is cached.
+  /// @throw std::runtime_error if a bracket mismatch is detected.
+  std::shared_ptr <const program_t>
+  get (const std::vector <char> &code);
+
+  /// @return The code to compile for the BF code in [@a code_begin,
+  /// @a code_end): its commands, without anything else. Programs with the
+  /// same canonical form behave the same, but for the source positions in
+  /// their instructions.
+  static std::string
+  canonical (const char *code_begin, const char *code_end);
+
+private:
+  struct entry_t
+  {
+    std::string code;
+    std::shared_ptr <const program_t> program;
+  };
+  typedef std::list <entry_t> entries_t;
+
+  const size_t capacity_;
+  std::mutex mutex_;
+
+  /// Most recently used first.
+  entries_t entries_;
+
+  std::unordered_map <size_t, entries_t::iterator> index_;
+
+  program_cache_t (const program_cache_t &) = delete;
+  program_cache_t & operator = (const program_cache_t &) = delete;
+};
+
+/// Threads running the jobs too heavy for the event loop's thread, so that
+/// they don't hold up everyone else's I/O. Each thread compiles into its own
+/// arena, unless programs are cached. Connections come back through
+/// finished (), and an eventfd becomes readable whenever there are some.
+class job_pool_t
+{
+public:
+  /// @throw std::runtime_error if the eventfd can't be created.
+  job_pool_t (
+    const options_t &options, size_t threads, program_cache_t *cache
+  );
+
+  ~job_pool_t ();
+
+  /// Readable (eight bytes) when connections have finished.
+  int
+  fd () const { return fd_; }
+
+  /// Queues @a c, whose request a thread will turn into its response.
+  void
+  push (connection_t *c);
+
+  /// Moves the connections whose response is ready into @a connections.
+  void
+  finished (std::vector <connection_t *> *connections);
+
+private:
+  void
+  work ();
+
+  const options_t &options_;
+  program_cache_t *const cache_;
+  int fd_;
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::deque <connection_t *> queued_;
+  std::vector <connection_t *> finished_;
+  bool stopping_ = false;
+  std::vector <std::thread> threads_;
+
+  job_pool_t (const job_pool_t &) = delete;
+  job_pool_t & operator = (const job_pool_t &) = delete;
+};
+
+} // anonymous namespace
+
+buffer_pool_t::buffer_pool_t (size_t count, size_t size)
+: count_  (count),
+  size_   (size),
+  memory_ (nullptr)
+{
+  void *memory = mmap (
+    nullptr, count * size, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+  );
+  if (MAP_FAILED == memory)
+    throw std::runtime_error ("unable to allocate I/O buffers");
+
+  memory_ = static_cast <char *> (memory);
+  for (size_t i = count; i > 0; --i)
+    free_.push_back (i - 1);
+}
+
+buffer_pool_t::~buffer_pool_t ()
+{
+  munmap (memory_, count_ * size_);
+}
+
+int
+buffer_pool_t::acquire ()
+{
+  if (free_.empty ())
+    return -1;
+
+  const int index = free_.back ();
+  free_.pop_back ();
+  return index;
+}
+
+uring_loop_t::uring_loop_t (buffer_pool_t *pool, unsigned entries)
+: fd_      (-1),
+  fixed_   (false),
+  queued_  (0),
+  sq_ring_ (MAP_FAILED),
+  cq_ring_ (MAP_FAILED),
+  sqes_    (static_cast <io_uring_sqe *> (MAP_FAILED))
+{
+  io_uring_params params;
+  std::memset (&params, 0, sizeof params);
+  fd_ = syscall (SYS_io_uring_setup, entries, &params);
+  if (fd_ < 0)
+    throw std::runtime_error ("io_uring unavailable");
+
+  // The destructor won't run if construction fails.
+  auto fail = [this] (const char *what) {
+    release ();
+    throw std::runtime_error (what);
+  };
+
+  std::vector <char> probe_memory (
+    sizeof (io_uring_probe) + 256 * sizeof (io_uring_probe_op), 0
+  );
+  auto probe = reinterpret_cast <io_uring_probe *> (probe_memory.data ());
+  if (syscall (SYS_io_uring_register, fd_, IORING_REGISTER_PROBE, probe, 256)
+    || probe->last_op < IORING_OP_ACCEPT
+    || !(probe->ops[IORING_OP_ACCEPT].flags & IO_URING_OP_SUPPORTED))
+  {
+    fail ("io_uring lacks accept");
+  }
+
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof (unsigned);
+  cq_ring_size_ =
+    params.cq_off.cqes + params.cq_entries * sizeof (io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    sq_ring_size_ = cq_ring_size_ = std::max (sq_ring_size_, cq_ring_size_);
+
+  sq_ring_ = mmap (
+    nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING
+  );
+  if (MAP_FAILED == sq_ring_)
+    fail ("unable to map io_uring");
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    cq_ring_ = sq_ring_;
+  }
+  else
+  {
+    cq_ring_ = mmap (
+      nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING
+    );
+    if (MAP_FAILED == cq_ring_)
+      fail ("unable to map io_uring");
+  }
+
+  sqes_size_ = params.sq_entries * sizeof (io_uring_sqe);
+  sqes_ = static_cast <io_uring_sqe *> (mmap (
+    nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+    fd_, IORING_OFF_SQES
+  ));
+  if (MAP_FAILED == sqes_)
+    fail ("unable to map io_uring");
+
+  auto sq = static_cast <char *> (sq_ring_);
+  sq_head_ = reinterpret_cast <unsigned *> (sq + params.sq_off.head);
+  sq_tail_ = reinterpret_cast <unsigned *> (sq + params.sq_off.tail);
+  sq_mask_ = reinterpret_cast <unsigned *> (sq + params.sq_off.ring_mask);
+  sq_entries_ =
+    reinterpret_cast <unsigned *> (sq + params.sq_off.ring_entries);
+  sq_array_ = reinterpret_cast <unsigned *> (sq + params.sq_off.array);
+
+  auto cq = static_cast <char *> (cq_ring_);
+  cq_head_ = reinterpret_cast <unsigned *> (cq + params.cq_off.head);
+  cq_tail_ = reinterpret_cast <unsigned *> (cq + params.cq_off.tail);
+  cq_mask_ = reinterpret_cast <unsigned *> (cq + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast <io_uring_cqe *> (cq + params.cq_off.cqes);
+
+  // Registering pins the buffers; without it (e.g. a low RLIMIT_MEMLOCK)
+  // plain reads and writes still work.
+  std::vector <iovec> iovecs (pool->count ());
+  for (size_t i = 0; i < iovecs.size (); ++i)
+    iovecs[i] = {pool->data (i), pool->size ()};
+  fixed_ = 0 == syscall (
+    SYS_io_uring_register, fd_, IORING_REGISTER_BUFFERS, iovecs.data (),
+    unsigned (iovecs.size ())
+  );
+}
+
+uring_loop_t::~uring_loop_t ()
+{
+  release ();
+}
+
+void
+uring_loop_t::release ()
+{
+  if (MAP_FAILED != sqes_)
+    munmap (sqes_, sqes_size_);
+  if (MAP_FAILED != cq_ring_ && cq_ring_ != sq_ring_)
+    munmap (cq_ring_, cq_ring_size_);
+  if (MAP_FAILED != sq_ring_)
+    munmap (sq_ring_, sq_ring_size_);
+  if (fd_ >= 0)
+    close (fd_);
+
+  sqes_ = static_cast <io_uring_sqe *> (MAP_FAILED);
+  cq_ring_ = sq_ring_ = MAP_FAILED;
+  fd_ = -1;
+}
+
+void
+uring_loop_t::submit (const io_request_t &request)
+{
+  const unsigned tail = *sq_tail_;
+  if (tail - __atomic_load_n (sq_head_, __ATOMIC_ACQUIRE) == *sq_entries_)
+    enter (0);
+
+  const unsigned index = tail & *sq_mask_;
+  io_uring_sqe &sqe = sqes_[index];
+  std::memset (&sqe, 0, sizeof sqe);
+  sqe.fd = request.fd;
+  sqe.user_data = reinterpret_cast <uintptr_t> (request.user);
+  switch (request.op)
+  {
+  case io_request_t::ACCEPT:
+    sqe.opcode = IORING_OP_ACCEPT;
+    sqe.accept_flags = SOCK_CLOEXEC;
+    break;
+  case io_request_t::READ:
+  case io_request_t::WRITE:
+    {
+      const bool read = io_request_t::READ == request.op;
+      if (fixed_ && request.buffer >= 0)
+      {
+        sqe.opcode = read ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+        sqe.buf_index = request.buffer;
+      }
+      else
+      {
+        sqe.opcode = read ? IORING_OP_READ : IORING_OP_WRITE;
+      }
+      sqe.addr = reinterpret_cast <uintptr_t> (request.data);
+      sqe.len = request.length;
+    }
+    break;
+  }
+
+  sq_array_[index] = index;
+  __atomic_store_n (sq_tail_, tail + 1, __ATOMIC_RELEASE);
+  ++queued_;
+}
+
+void
+uring_loop_t::enter (unsigned min_complete)
+{
+  for (;;)
+  {
+    const int submitted = syscall (
+      SYS_io_uring_enter, fd_, queued_, min_complete,
+      min_complete ? IORING_ENTER_GETEVENTS : 0, nullptr, 0
+    );
+    if (submitted >= 0)
+    {
+      queued_ -= std::min <unsigned> (queued_, submitted);
+      return;
+    }
+    if (EINTR != errno && EAGAIN != errno && EBUSY != errno)
+      throw std::runtime_error ("io_uring_enter failed");
+  }
+}
+
+void
+uring_loop_t::wait (std::vector <io_completion_t> *completions)
+{
+  completions->clear ();
+  enter (1);
+
+  unsigned head = *cq_head_;
+  const unsigned tail = __atomic_load_n (cq_tail_, __ATOMIC_ACQUIRE);
+  for (; head != tail; ++head)
+  {
+    const io_uring_cqe &cqe = cqes_[head & *cq_mask_];
+    completions->push_back (
+      {reinterpret_cast <void *> (uintptr_t (cqe.user_data)), cqe.res}
+    );
+  }
+  __atomic_store_n (cq_head_, head, __ATOMIC_RELEASE);
+}
+
+epoll_loop_t::epoll_loop_t ()
+: fd_ (epoll_create1 (EPOLL_CLOEXEC))
+{
+  if (fd_ < 0)
+    throw std::runtime_error ("unable to create epoll instance");
+}
+
+epoll_loop_t::~epoll_loop_t ()
+{
+  close (fd_);
+}
+
+void
+epoll_loop_t::submit (const io_request_t &request)
+{
+  queued_.push_back (request);
+}
+
+bool
+epoll_loop_t::attempt (const io_request_t &request, io_completion_t *completion)
+{
+  ssize_t result = 0;
+  switch (request.op)
+  {
+  case io_request_t::ACCEPT:
+    result = accept4 (
+      request.fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC
+    );
+    break;
+  case io_request_t::READ:
+    result = read (request.fd, request.data, request.length);
+    break;
+  case io_request_t::WRITE:
+    result = write (request.fd, request.data, request.length);
+    break;
+  }
+
+  if (result < 0 && (EAGAIN == errno || EWOULDBLOCK == errno))
+    return false;
+
+  *completion = {request.user, result < 0 ? -errno : result};
+  return true;
+}
+
+void
+epoll_loop_t::wait (std::vector <io_completion_t> *completions)
+{
+  completions->clear ();
+  while (completions->empty ())
+  {
+    for (const auto &request : queued_)
+    {
+      io_completion_t completion;
+      if (attempt (request, &completion))
+      {
+        completions->push_back (completion);
+        continue;
+      }
+
+      // Descriptors stay registered (disarmed) between requests, and leave
+      // the epoll set by themselves when closed.
+      epoll_event event;
+      event.events = EPOLLONESHOT
+        | (io_request_t::WRITE == request.op ? EPOLLOUT : EPOLLIN);
+      event.data.fd = request.fd;
+      parked_[request.fd] = request;
+      if (epoll_ctl (fd_, EPOLL_CTL_MOD, request.fd, &event) && ENOENT == errno
+        && epoll_ctl (fd_, EPOLL_CTL_ADD, request.fd, &event))
+      {
+        throw std::runtime_error ("epoll_ctl failed");
+      }
+    }
+    queued_.clear ();
+
+    if (!completions->empty ())
+      break;
+
+    epoll_event events[64];
+    const int n = epoll_wait (fd_, events, 64, -1);
+    if (n < 0 && EINTR != errno)
+      throw std::runtime_error ("epoll_wait failed");
+
+    for (int i = 0; i < n; ++i)
+    {
+      auto parked = parked_.find (events[i].data.fd);
+      if (parked == end (parked_))
+        continue;
+
+      queued_.push_back (parked->second);
+      parked_.erase (parked);
+    }
+  }
+}
+
+std::shared_ptr <const program_t>
+program_cache_t::get (const std::vector <char> &code)
+{
+  const std::string key = canonical (code.data (), code.data () + code.size ());
+  const size_t hash = std::hash <std::string> () (key);
+  {
+    std::lock_guard <std::mutex> lock (mutex_);
+    auto i = index_.find (hash);
+    if (end (index_) != i && i->second->code == key)
+    {
+      entries_.splice (begin (entries_), entries_, i->second);
+      return i->second->program;
+    }
+  }
+
+  // Compiling doesn't hold up the other threads. Should two compile the
+  // same program, the second one's replaces the first one's.
+  std::shared_ptr <const program_t> program =
+    std::make_shared <const program_t> (begin (key), end (key));
+
+  std::lock_guard <std::mutex> lock (mutex_);
+  auto i = index_.find (hash);
+  if (end (index_) != i)
+    entries_.erase (i->second);
+  entries_.push_front ({key, program});
+  index_[hash] = begin (entries_);
+  if (entries_.size () > capacity_)
+  {
+    index_.erase (std::hash <std::string> () (entries_.back ().code));
+    entries_.pop_back ();
+  }
+  return program;
+}
+
+std::string
+program_cache_t::canonical (const char *code_begin, const char *code_end)
+{
+  std::string code;
+  for (auto cp = code_begin; cp != code_end; ++cp)
+  {
+    if (*cp && std::strchr ("+-<>.,[]", *cp))
+      code.push_back (*cp);
+  }
+  return code;
+}
+
+/// Runs the HackerRank style job sent on @a c, producing its response: a
+/// status line, "ok" or "error: <reason>", then the program's output.
+/// Compiling allocates from @a arena, which is reset once the job is done,
+/// unless the program comes from @a cache.
+/// Given a @a pool, jobs estimated to take more than @a heavy operations go
+/// there instead (to be parsed and compiled again, which is cheap next to
+/// running them).
+/// @return false if @a c went to @a pool.
+static bool
+serve_job (
+  const options_t &options, connection_t *c, arena_t *arena,
+  program_cache_t *cache, job_pool_t *pool = nullptr, size_t heavy = 0 )
+{
+  struct reset_t
+  {
+    arena_t *arena;
+    ~reset_t () { arena->reset (); }
+  } reset {arena};
+
+  std::ostringstream out;
+  try
+  {
+    job_t job;
+    parse_job (
+      c->request.data (), c->request.data () + c->request.size (), &job
+    );
+
+    const std::shared_ptr <const program_t> program = cache
+      ? cache->get (job.code)
+      : std::make_shared <const program_t> (
+        begin (job.code), end (job.code), arena
+      );
+    if (pool && std::min (
+        cost_estimate_t (*program, arena).operations (),
+        operation_limit (options)
+      ) > heavy)
+    {
+      pool->push (c);
+      return false;
+    }
+
+    context_t context;
+    context.set_max_operations (operation_limit (options));
+    std::istringstream input (job.input);
+    std::ostringstream output;
+    (void) context.execute (*program, input, output);
+
+    out << "ok\n" << output.str () << '\n';
+  }
+  catch (const std::exception &e)
+  {
+    out.str ("");
+    out << "error: " << e.what () << '\n';
+  }
+
+  c->response = out.str ();
+  c->request.clear ();
+  return true;
+}
+
+job_pool_t::job_pool_t (
+  const options_t &options, size_t threads, program_cache_t *cache )
+: options_ (options),
+  cache_ (cache),
+  fd_ (eventfd (0, EFD_CLOEXEC))
+{
+  if (fd_ < 0)
+    throw std::runtime_error ("unable to create eventfd");
+
+  for (size_t i = 0; i < threads; ++i)
+    threads_.emplace_back (&job_pool_t::work, this);
+}
+
+job_pool_t::~job_pool_t ()
+{
+  {
+    std::lock_guard <std::mutex> lock (mutex_);
+    stopping_ = true;
+  }
+  ready_.notify_all ();
+  for (auto &thread : threads_)
+    thread.join ();
+
+  close (fd_);
+}
+
+void
+job_pool_t::push (connection_t *c)
+{
+  {
+    std::lock_guard <std::mutex> lock (mutex_);
+    queued_.push_back (c);
+  }
+  ready_.notify_one ();
+}
+
+void
+job_pool_t::finished (std::vector <connection_t *> *connections)
+{
+  std::lock_guard <std::mutex> lock (mutex_);
+  connections->swap (finished_);
+  finished_.clear ();
+}
+
+void
+job_pool_t::work ()
+{
+  arena_t arena;
+  std::unique_lock <std::mutex> lock (mutex_);
+  for (;;)
+  {
+    ready_.wait (lock, [this] { return stopping_ || !queued_.empty (); });
+    if (stopping_)
+      return;
+
+    connection_t *c = queued_.front ();
+    queued_.pop_front ();
+    lock.unlock ();
+    (void) serve_job (options_, c, &arena, cache_);
+    lock.lock ();
+
+    finished_.push_back (c);
+    const uint64_t one = 1;
+    (void) write (fd_, &one, sizeof one);
+  }
+}
+
+/// Serves jobs on a Unix domain socket. Each connection sends one HackerRank
+/// style job, shuts down its side, and receives the response. I/O goes
+/// through io_uring with registered buffers when the kernel allows it, epoll
+/// otherwise. Jobs run on the event loop's thread, unless their static cost
+/// estimate is high enough to hold up other connections, which sends them to
+/// a pool of --jobs threads.
+static int
+run_server (const options_t &options)
+{
+  static const size_t CONNECTIONS = 64;
+  static const size_t BUFFER_SIZE = 1 << 16;
+
+  // Estimated operations past which a job runs in the pool.
+  static const size_t HEAVY_OPERATIONS = 1 << 20;
+
+  signal (SIGPIPE, SIG_IGN);
+
+  sockaddr_un address;
+  std::memset (&address, 0, sizeof address);
+  address.sun_family = AF_UNIX;
+  if (options.serve.size () >= sizeof address.sun_path)
+  {
+    std::cerr << "Socket path too long: " << options.serve << std::endl;
+    return 1;
+  }
+  std::strcpy (address.sun_path, options.serve.c_str ());
+
+  struct stat st;
+  if (0 == lstat (options.serve.c_str (), &st) && S_ISSOCK (st.st_mode))
+    unlink (options.serve.c_str ());
+
+  const int listener = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listener < 0
+    || bind (listener, reinterpret_cast <sockaddr *> (&address), sizeof address)
+    || listen (listener, SOMAXCONN))
+  {
+    std::cerr << "Unable to listen on " << options.serve << ": "
+      << std::strerror (errno) << std::endl;
+    return 1;
+  }
+
+  // Jobs run on this thread, and share its arena for compiling, unless their
+  // cost estimate sends them to the pool.
+  arena_t arena;
+  std::unique_ptr <program_cache_t> cache;
+  std::unique_ptr <buffer_pool_t> pool;
+  std::unique_ptr <event_loop_t> loop;
+  std::unique_ptr <job_pool_t> heavy_jobs;
+  if (options.cache)
+    cache.reset (new program_cache_t (options.cache));
+  try
+  {
+    pool.reset (new buffer_pool_t (CONNECTIONS, BUFFER_SIZE));
+    // Jobs sent to a pool without threads would never be answered.
+    heavy_jobs.reset (new job_pool_t (
+      options, std::max <size_t> (1, jobs_wanted (options)), cache.get ()
+    ));
+    try
+    {
+      loop.reset (new uring_loop_t (pool.get (), 2 * CONNECTIONS));
+    }
+    catch (const std::exception &)
+    {
+      // Nonblocking, for epoll's sake; io_uring manages blocking itself.
+      for (int fd : {listener, heavy_jobs->fd ()})
+        fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+      loop.reset (new epoll_loop_t ());
+    }
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << e.what () << std::endl;
+    return 1;
+  }
+  std::cerr << "Serving on " << options.serve << " using " << loop->name ()
+    << std::endl;
+
+  // The listener's completions carry a null user pointer, the job pool's
+  // point at its counter.
+  uint64_t finished_count;
+  std::vector <connection_t *> finished;
+  auto await_finished = [&] () {
+    loop->submit ({
+      io_request_t::READ, heavy_jobs->fd (),
+      reinterpret_cast <char *> (&finished_count), sizeof finished_count, -1,
+      &finished_count
+    });
+  };
+
+  bool accepting = false;
+  auto accept_more = [&] () {
+    if (!accepting && !pool->empty ())
+    {
+      loop->submit ({io_request_t::ACCEPT, listener, nullptr, 0, -1, nullptr});
+      accepting = true;
+    }
+  };
+  auto receive = [&] (connection_t *c) {
+    loop->submit ({
+      io_request_t::READ, c->fd, pool->data (c->buffer), pool->size (),
+      c->buffer, c
+    });
+  };
+  auto send = [&] (connection_t *c) {
+    const size_t length =
+      std::min (pool->size (), c->response.size () - c->written);
+    std::memcpy (
+      pool->data (c->buffer), c->response.data () + c->written, length
+    );
+    loop->submit ({
+      io_request_t::WRITE, c->fd, pool->data (c->buffer), length, c->buffer,
+      c
+    });
+  };
+  auto finish = [&] (connection_t *c) {
+    close (c->fd);
+    pool->release (c->buffer);
+    delete c;
+    accept_more ();
+  };
+
+  accept_more ();
+  await_finished ();
+  std::vector <io_completion_t> completions;
+  for (;;)
+  {
+    try
+    {
+      loop->wait (&completions);
+    }
+    catch (const std::exception &e)
+    {
+      std::cerr << e.what () << std::endl;
+      return 1;
+    }
+
+    for (const auto &completion : completions)
+    {
+      if (!completion.user)
+      {
+        accepting = false;
+        if (completion.result >= 0)
+        {
+          auto c = new connection_t;
+          c->fd = completion.result;
+          c->buffer = pool->acquire ();
+          receive (c);
+        }
+        accept_more ();
+        continue;
+      }
+
+      if (&finished_count == completion.user)
+      {
+        heavy_jobs->finished (&finished);
+        for (auto c : finished)
+          send (c);
+        await_finished ();
+        continue;
+      }
+
+      auto c = static_cast <connection_t *> (completion.user);
+      if (completion.result < 0)
+      {
+        finish (c);
+      }
+      else if (c->response.empty ())
+      {
+        if (completion.result > 0)
+        {
+          c->request.append (pool->data (c->buffer), completion.result);
+          receive (c);
+          continue;
+        }
+
+        const bool answered = serve_job (
+          options, c, &arena, cache.get (), heavy_jobs.get (),
+          HEAVY_OPERATIONS
+        );
+        if (answered)
+          send (c);
+      }
+      else
+      {
+        c->written += completion.result;
+        if (c->written < c->response.size ())
+          send (c);
+        else
+          finish (c);
+      }
+    }
+  }
+}
+
+namespace
+{
+
+/// Operations between the checkpoints of a recording.
+static const size_t CHECKPOINT_INTERVAL = 1 << 24;
+
+/// Identifies a recording, and its format version.
+static const char RECORDING_MAGIC[] = "bfrec 1\n";
+
+/// Identifies a compiled program, and its format version.
+static const char ARTIFACT_MAGIC[] = "bfbin 1\n";
+
+/// Version of the optimized form. Compiled programs of another one are
+/// stale, so this goes up whenever fused_t or the meaning of its ops
+/// changes.
+static const uint64_t FUSED_VERSION = 1;
+
+/// Header of a compiled program, which its instructions, then its fused ops
+/// follow, as laid out in memory, in host byte order.
+struct artifact_header_t
+{
+  char magic[sizeof ARTIFACT_MAGIC - 1];
+  uint64_t version;
+
+  /// Sizes of instruction_t and fused_t, which also tell byte orders and
+  /// word sizes apart.
+  uint64_t instruction_size, fused_size;
+
+  uint64_t instructions, fused;
+
+  /// FNV-1a hash of what follows the header.
+  uint64_t checksum;
+};
+
+/// A file mapped read-only, for as long as this lives. Anything but a regular
+/// file (a pipe, say) is read into memory instead.
+class mapping_t
+{
+public:
+  /// @throw std::runtime_error if the file can't be mapped or read.
+  explicit mapping_t (const std::string &path);
+
+  ~mapping_t ();
+
+  const char *
+  data () const { return data_; }
+
+  size_t
+  size () const { return size_; }
+
+private:
+  const char *data_;
+  size_t size_;
+
+  /// Whether data_ is mapped, rather than in contents_.
+  bool mapped_;
+  std::string contents_;
+
+  mapping_t (const mapping_t &) = delete;
+  mapping_t & operator = (const mapping_t &) = delete;
+};
+
+/// The state of a run after some operations, from which it can be
+/// re-executed given the input that followed.
+struct checkpoint_t
+{
+  size_t operations;
+  size_t ip;
+
+  /// Input bytes consumed so far.
+  size_t input_offset;
+
+  size_t position;
+
+  /// The tape from the first slot, without trailing zeros.
+  std::string cells;
+};
+
+/// Describes the state of @a c, about to execute instruction @a ip having
+/// consumed @a input_offset input bytes, in @a checkpoint.
+static void
+take_checkpoint (
+  const context_t &c, size_t ip, size_t input_offset,
+  checkpoint_t *checkpoint )
+{
+  checkpoint->operations = c.operations ();
+  checkpoint->ip = ip;
+  checkpoint->input_offset = input_offset;
+  checkpoint->position = c.position ();
+  checkpoint->cells.clear ();
+  for (size_t slot = 0; slot < c.tape_size (); ++slot)
+    checkpoint->cells.push_back (c.cell (slot));
+  checkpoint->cells.erase (checkpoint->cells.find_last_not_of ('\0') + 1);
+}
+
+/// Input stream buffer passing another one through, and appending what it
+/// reads from it to a recording, as it reads it.
+class recorder_t : public std::streambuf
+{
+public:
+  recorder_t (std::streambuf *source, std::ostream &log);
+
+  /// @return The bytes consumed through this buffer.
+  size_t
+  consumed () const { return fetched_ - (egptr () - gptr ()); }
+
+protected:
+  int_type
+  underflow () override;
+
+private:
+  std::streambuf *source_;
+  std::ostream &log_;
+  char buffer_[4096];
+  size_t fetched_;
+};
+
+/// Interactive debugger. Breakpoints are BREAK_OP instructions patched into
+/// a private copy of the program, so between stops the program runs without
+/// per-instruction checks, and the engine pays nothing for debugging
+/// otherwise. It runs on the plain interpreter, though, as the optimized form
+/// can't stop at an arbitrary instruction. A single step patches breaks over
+/// the instructions that may run next; watchpoints make continuing
+/// single-step.
+///
+/// Going to an operation count, backwards included, restores the nearest
+/// checkpoint before it and re-executes from there, without output. Given
+/// a recording's checkpoints, that reaches any point of a long run quickly;
+/// more are taken as the debugger runs.
+class debugger_t
+{
+public:
+  /// Debugs @a program, compiled from @a code (whose `#` markers become
+  /// breakpoints), on @a input, which has to be seekable, writing its output
+  /// to @a out. @a checkpoints, in order, are states of the run.
+  debugger_t (
+    const program_t &program, const std::vector <char> &code,
+    const options_t &options, std::istream &input, std::ostream &out,
+    const std::vector <checkpoint_t> &checkpoints = {}
+  );
+
+  /// Reads and carries out commands until `quit` or the end of @a commands,
+  /// reporting to @a report.
+  void
+  run (std::istream &commands, std::ostream &report);
+
+private:
+  /// Executes the next instruction.
+  /// @throw std::runtime_error if the program fails.
+  void
+  step ();
+
+  /// Executes until a breakpoint, a watched cell changing, or the end.
+  /// @return What stopped execution.
+  /// @throw std::runtime_error if the program fails.
+  const char *
+  proceed ();
+
+  /// Moves to the state after @a operations operations, or the end of the
+  /// run if it comes first.
+  /// @throw std::runtime_error if the program fails.
+  void
+  go_to (size_t operations);
+
+  /// Saves the current state, unless a checkpoint is close enough before it.
+  void
+  save ();
+
+  /// Restores instruction @a index to its op, or a break if it has a
+  /// breakpoint.
+  void
+  patch (size_t index);
+
+  /// @return The first instruction at or after source @a position.
+  size_t
+  instruction_at (size_t position) const;
+
+  /// @return Whether a watched cell changed, updating the values seen.
+  bool
+  watch_changed ();
+
+  void
+  where (std::ostream &report) const;
+
+  void
+  dump (std::ostream &report, size_t radius) const;
+
+  const program_t &program_;
+  program_t code_;
+  context_t context_;
+  std::istream &input_;
+  std::ostream &out_;
+
+  /// Instruction indices.
+  std::set <size_t> breakpoints_;
+
+  /// Last value seen in each watched slot.
+  std::map <size_t, unsigned char> watchpoints_;
+
+  /// By operation count.
+  std::map <size_t, checkpoint_t> checkpoints_;
+
+  /// The next instruction to execute.
+  size_t ip_;
+};
+
+} // anonymous namespace
+
+debugger_t::debugger_t (
+  const program_t &program, const std::vector <char> &code,
+  const options_t &options, std::istream &input, std::ostream &out,
+  const std::vector <checkpoint_t> &checkpoints )
+: program_ (program),
+  code_    (program),
+  input_   (input),
+  out_     (out),
+  ip_      (0)
+{
+  context_.set_max_operations (operation_limit (options));
+  checkpoints_[0] = checkpoint_t {0, 0, 0, 0, std::string ()};
+  for (const auto &checkpoint : checkpoints)
+    checkpoints_[checkpoint.operations] = checkpoint;
+
+  for (size_t position = 0; position < code.size (); ++position)
+  {
+    const size_t index = instruction_at (position);
+    if (BREAK_OP == code[position] && index < program.size ())
+    {
+      breakpoints_.insert (index);
+      patch (index);
+    }
+  }
+}
+
+void
+debugger_t::run (std::istream &commands, std::ostream &report)
+{
+  const bool interactive = &commands == &std::cin && isatty (STDIN_FILENO);
+  std::string line;
+  auto next = [&] () {
+    if (interactive)
+      report << "(bf) " << std::flush;
+    return static_cast <bool> (getline (commands, line));
+  };
+
+  where (report);
+  while (next ())
+  {
+    std::istringstream words (line);
+    std::string command;
+    size_t n;
+    const bool has_n = static_cast <bool> (words >> command >> n);
+    if (command.empty ())
+      continue;
+
+    try
+    {
+      const bool running = ip_ < program_.size ();
+      if ("s" == command || "step" == command)
+      {
+        for (size_t i = 0; i < (has_n ? n : 1) && ip_ < program_.size (); ++i)
+          step ();
+        if (running)
+          where (report);
+      }
+      else if ("c" == command || "continue" == command)
+      {
+        const char *reason = running ? proceed () : nullptr;
+        out_.flush ();
+        if (reason)
+          report << reason << ' ';
+        where (report);
+      }
+      else if ("b" == command || "break" == command)
+      {
+        if (has_n && instruction_at (n) < program_.size ())
+        {
+          const size_t index = instruction_at (n);
+          breakpoints_.insert (index);
+          patch (index);
+        }
+        for (auto index : breakpoints_)
+          report << "breakpoint at " << program_.begin ()[index].position
+            << '\n';
+      }
+      else if (("d" == command || "delete" == command) && has_n)
+      {
+        const size_t index = instruction_at (n);
+        if (breakpoints_.erase (index))
+          patch (index);
+      }
+      else if (("w" == command || "watch" == command) && has_n)
+      {
+        watchpoints_[n] = context_.cell (n);
+      }
+      else if ("unwatch" == command && has_n)
+      {
+        watchpoints_.erase (n);
+      }
+      else if (("g" == command || "goto" == command) && has_n)
+      {
+        go_to (n);
+        where (report);
+      }
+      else if ("back" == command)
+      {
+        const size_t operations = context_.operations ();
+        go_to (operations - std::min (operations, has_n ? n : 1));
+        where (report);
+      }
+      else if ("t" == command || "tape" == command)
+      {
+        dump (report, has_n ? n : 8);
+      }
+      else if ("q" == command || "quit" == command)
+      {
+        break;
+      }
+      else
+      {
+        report << "commands: step [N], continue, break [POSITION],"
+          << " delete POSITION,\n"
+          << "          watch SLOT, unwatch SLOT, goto OPERATIONS, back [N],\n"
+          << "          tape [RADIUS], quit\n";
+      }
+      save ();
+    }
+    catch (const std::exception &e)
+    {
+      out_.flush ();
+      report << "error: " << e.what () << '\n';
+      ip_ = program_.size ();
+    }
+    report << std::flush;
+  }
+}
+
+void
+debugger_t::step ()
+{
+  const instruction_t &instruction = program_.begin ()[ip_];
+  size_t next[] = {ip_ + 1, ip_ + 1};
+  if ('[' == instruction.op || ']' == instruction.op)
+    next[1] = instruction.jump + 1;
+
+  const size_t ip = ip_;
+  for (auto n : next)
+  {
+    if (n < program_.size ())
+      code_.patch (n, BREAK_OP);
+  }
+  code_.patch (ip, instruction.op);
+
+  auto restore = [&] () {
+    for (auto n : next)
+    {
+      if (n < program_.size ())
+        patch (n);
+    }
+    patch (ip);
+  };
+  try
+  {
+    ip_ = context_.resume (code_, ip, input_, out_);
+  }
+  catch (...)
+  {
+    restore ();
+    throw;
+  }
+  restore ();
+}
+
+const char *
+debugger_t::proceed ()
+{
+  step ();
+  for (;;)
+  {
+    if (ip_ == program_.size ())
+      return nullptr;
+    if (watch_changed ())
+      return "watchpoint";
+    if (breakpoints_.count (ip_))
+      return "breakpoint";
+
+    if (watchpoints_.empty ())
+      ip_ = context_.resume (code_, ip_, input_, out_);
+    else
+      step ();
+  }
+}
+
+void
+debugger_t::go_to (size_t operations)
+{
+  // Carrying on beats restoring when no checkpoint lies in between.
+  const auto &checkpoint = std::prev (checkpoints_.upper_bound (operations))
+    ->second;
+  if (ip_ == program_.size () || operations < context_.operations ()
+    || checkpoint.operations > context_.operations ())
+  {
+    context_.restore (
+      checkpoint.cells, checkpoint.position, checkpoint.operations
+    );
+    input_.clear ();
+    input_.rdbuf ()->pubseekpos (checkpoint.input_offset, std::ios::in);
+    ip_ = checkpoint.ip;
+  }
+
+  std::ostream none (nullptr);
+  ip_ = context_.resume (program_, ip_, input_, none, operations);
+  (void) watch_changed ();
+}
+
+void
+debugger_t::save ()
+{
+  const size_t operations = context_.operations ();
+  if (ip_ == program_.size ()
+    || std::prev (checkpoints_.upper_bound (operations))->first
+      + CHECKPOINT_INTERVAL > operations)
+    return;
+
+  take_checkpoint (
+    context_, ip_, input_.rdbuf ()->pubseekoff (0, std::ios::cur, std::ios::in),
+    &checkpoints_[operations]
+  );
+}
+
+void
+debugger_t::patch (size_t index)
+{
+  code_.patch (
+    index, breakpoints_.count (index) ? BREAK_OP : program_.begin ()[index].op
+  );
+}
+
+size_t
+debugger_t::instruction_at (size_t position) const
+{
+  return std::lower_bound (
+    program_.begin (), program_.end (), position,
+    [] (const instruction_t &i, size_t p) { return i.position < p; }
+  ) - program_.begin ();
+}
+
+bool
+debugger_t::watch_changed ()
+{
+  bool changed = false;
+  for (auto &watch : watchpoints_)
+  {
+    const unsigned char value = context_.cell (watch.first);
+    changed = changed || value != watch.second;
+    watch.second = value;
+  }
+  return changed;
+}
+
+void
+debugger_t::where (std::ostream &report) const
+{
+  if (ip_ < program_.size ())
+  {
+    const instruction_t &instruction = program_.begin ()[ip_];
+    report << "at " << instruction.position << " '" << instruction.op << "'";
+  }
+  else
+  {
+    report << "finished";
+  }
+
+  const size_t slot = context_.position ();
+  report << ", slot " << slot << " = " << int (context_.cell (slot)) << ", "
+    << context_.operations () << " operations\n";
+}
+
+void
+debugger_t::dump (std::ostream &report, size_t radius) const
+{
+  const size_t slot = context_.position ();
+  for (size_t i = slot > radius ? slot - radius : 0; i <= slot + radius; ++i)
+  {
+    const unsigned char value = context_.cell (i);
+    report << (i == slot ? '>' : ' ') << std::setw (7) << i << std::setw (5)
+      << int (value);
+    if (std::isprint (value))
+      report << " '" << value << "'";
+    report << '\n';
+  }
+}
+
+/// Appends @a n to a recording, in host byte order.
+static void
+write_number (std::ostream &log, uint64_t n)
+{
+  log.write (reinterpret_cast <const char *> (&n), sizeof n);
+}
+
+recorder_t::recorder_t (std::streambuf *source, std::ostream &log)
+: source_  (source),
+  log_     (log),
+  fetched_ (0)
+{
+}
+
+recorder_t::int_type
+recorder_t::underflow ()
+{
+  // Takes whatever the source has buffered, so a pipe isn't waited on for
+  // more than the program asked for.
+  if (traits_type::eq_int_type (source_->sgetc (), traits_type::eof ()))
+    return traits_type::eof ();
+
+  const std::streamsize n = source_->sgetn (
+    buffer_, std::min <std::streamsize> (sizeof buffer_, source_->in_avail ())
+  );
+  log_.put ('I');
+  write_number (log_, n);
+  log_.write (buffer_, n);
+
+  fetched_ += n;
+  setg (buffer_, buffer_, buffer_ + n);
+  return traits_type::to_int_type (*buffer_);
+}
+
+/// Appends @a checkpoint to a recording.
+static void
+write_checkpoint (std::ostream &log, const checkpoint_t &checkpoint)
+{
+  log.put ('C');
+  write_number (log, checkpoint.operations);
+  write_number (log, checkpoint.ip);
+  write_number (log, checkpoint.input_offset);
+  write_number (log, checkpoint.position);
+  write_number (log, checkpoint.cells.size ());
+  log.write (checkpoint.cells.data (), checkpoint.cells.size ());
+}
+
+/// Reads the recording at @a path, made by run_record () for @a program,
+/// into the input it consumed and its checkpoints.
+/// @throw std::runtime_error if the recording can't be read, is malformed,
+/// or doesn't fit the program.
+static void
+read_recording (
+  const std::string &path, const program_t &program, std::string *input,
+  std::vector <checkpoint_t> *checkpoints )
+{
+  std::string data;
+  read_file (path, &data);
+
+  const char *p = data.data ();
+  const char *const last = p + data.size ();
+  auto fail = [] () {
+    throw std::runtime_error ("malformed recording");
+  };
+  auto bytes = [&] (size_t n) {
+    if (size_t (last - p) < n)
+      fail ();
+    p += n;
+    return p - n;
+  };
+  auto number = [&] () {
+    uint64_t n;
+    std::memcpy (&n, bytes (sizeof n), sizeof n);
+    return n;
+  };
+
+  if (std::memcmp (bytes (sizeof RECORDING_MAGIC - 1), RECORDING_MAGIC,
+    sizeof RECORDING_MAGIC - 1))
+    fail ();
+
+  input->clear ();
+  checkpoints->clear ();
+  while (p != last)
+  {
+    const char type = *bytes (1);
+    if ('I' == type)
+    {
+      const size_t n = number ();
+      input->append (bytes (n), n);
+    }
+    else if ('C' == type)
+    {
+      checkpoint_t checkpoint;
+      checkpoint.operations = number ();
+      checkpoint.ip = number ();
+      checkpoint.input_offset = number ();
+      checkpoint.position = number ();
+      const size_t n = number ();
+      checkpoint.cells.assign (bytes (n), n);
+      if (checkpoint.ip > program.size ()
+        || checkpoint.input_offset > input->size ()
+        || (!checkpoints->empty ()
+          && checkpoint.operations <= checkpoints->back ().operations))
+        throw std::runtime_error ("recording doesn't fit the program");
+      checkpoints->push_back (std::move (checkpoint));
+    }
+    else
+    {
+      fail ();
+    }
+  }
+}
+
+mapping_t::mapping_t (const std::string &path)
+: data_   (nullptr),
+  size_   (0),
+  mapped_ (false)
+{
+  const int fd = open (path.c_str (), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || fstat (fd, &st))
+  {
+    if (fd >= 0)
+      close (fd);
+    throw std::runtime_error ("unable to open " + path);
+  }
+
+  // Pipes and the like have no size to map (nor does an empty file).
+  if (!S_ISREG (st.st_mode) || !st.st_size)
+  {
+    try
+    {
+      read_all (fd, &contents_);
+    }
+    catch (const std::exception &)
+    {
+      close (fd);
+      throw std::runtime_error ("unable to read " + path);
+    }
+    close (fd);
+    data_ = contents_.data ();
+    size_ = contents_.size ();
+    return;
+  }
+
+  size_ = st.st_size;
+  void *data = mmap (nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (MAP_FAILED == data)
+    throw std::runtime_error ("unable to read " + path);
+  data_ = static_cast <const char *> (data);
+  mapped_ = true;
+}
+
+mapping_t::~mapping_t ()
+{
+  if (mapped_)
+    munmap (const_cast <char *> (data_), size_);
+}
+
+/// @return The FNV-1a hash of [@a first, @a last), or of what hashed to
+/// @a hash followed by it.
+static uint64_t
+checksum (
+  const char *first, const char *last, uint64_t hash = 0xcbf29ce484222325 )
+{
+  for (auto p = first; p != last; ++p)
+    hash = (hash ^ (unsigned char) *p) * 0x100000001b3;
+  return hash;
+}
+
+/// Copies @a field into the record at @a record, @a offset bytes in.
+template <typename field_t>
+static void
+put_field (char *record, size_t offset, const field_t &field)
+{
+  std::memcpy (record + offset, &field, sizeof field);
+}
+
+/// Writes @a program, compiled, to the file at @a path, to be loaded by
+/// load_program ().
+/// @throw std::runtime_error if the file can't be written.
+static void
+write_artifact (const std::string &path, const program_t &program)
+{
+  // Laid out as in memory, field by field, so that the padding is zeros
+  // rather than whatever the program's memory held.
+  std::string instructions (program.size () * sizeof (instruction_t), '\0');
+  for (size_t i = 0; i < program.size (); ++i)
+  {
+    const instruction_t &from = program.begin ()[i];
+    char *const to = &instructions[i * sizeof (instruction_t)];
+    put_field (to, offsetof (instruction_t, op), from.op);
+    put_field (to, offsetof (instruction_t, jump), from.jump);
+    put_field (to, offsetof (instruction_t, position), from.position);
+  }
+
+  std::string fused (program.fused ().size () * sizeof (fused_t), '\0');
+  for (size_t i = 0; i < program.fused ().size (); ++i)
+  {
+    const fused_t &from = program.fused ()[i];
+    char *const to = &fused[i * sizeof (fused_t)];
+    put_field (to, offsetof (fused_t, op), from.op);
+    put_field (to, offsetof (fused_t, arg), from.arg);
+    put_field (to, offsetof (fused_t, offset), from.offset);
+    put_field (to, offsetof (fused_t, jump), from.jump);
+    put_field (to, offsetof (fused_t, cost), from.cost);
+    put_field (to, offsetof (fused_t, origin), from.origin);
+    put_field (to, offsetof (fused_t, low), from.low);
+  }
+
+  artifact_header_t header;
+  std::memset (&header, 0, sizeof header);
+  std::memcpy (header.magic, ARTIFACT_MAGIC, sizeof header.magic);
+  header.version = FUSED_VERSION;
+  header.instruction_size = sizeof (instruction_t);
+  header.fused_size = sizeof (fused_t);
+  header.instructions = program.size ();
+  header.fused = program.fused ().size ();
+  header.checksum = checksum (
+    fused.data (), fused.data () + fused.size (),
+    checksum (instructions.data (), instructions.data () + instructions.size ())
+  );
+
+  std::ofstream file (path, std::ios::out | std::ios::binary);
+  file.write (reinterpret_cast <const char *> (&header), sizeof header);
+  file.write (instructions.data (), instructions.size ());
+  file.write (fused.data (), fused.size ());
+  file.close ();
+  if (!file)
+    throw std::runtime_error ("unable to write " + path);
+}
+
+/// Loads the program at @a path: compiled by write_artifact (), or else BF
+/// code, which is compiled.
+/// @throw std::runtime_error if the file can't be read, a compiled program
+/// is stale or corrupt, or the code has a bracket mismatch.
+static std::unique_ptr <program_t>
+load_program (const std::string &path)
+{
+  const mapping_t file (path);
+  const char *const data = file.data ();
+  if (file.size () < sizeof (artifact_header_t)
+    || std::memcmp (data, ARTIFACT_MAGIC, sizeof ARTIFACT_MAGIC - 1))
+  {
+    return std::unique_ptr <program_t> (
+      new program_t (data, data + file.size ())
+    );
+  }
+
+  artifact_header_t header;
+  std::memcpy (&header, data, sizeof header);
+  if (FUSED_VERSION != header.version
+    || sizeof (instruction_t) != header.instruction_size
+    || sizeof (fused_t) != header.fused_size)
+    throw std::runtime_error ("compiled by another version");
+
+  auto fail = [&] () {
+    throw std::runtime_error ("corrupt compiled program");
+  };
+  const size_t size = header.instructions;
+  const size_t fused_size = header.fused;
+  const size_t available = file.size () - sizeof header;
+  if (size > available / sizeof (instruction_t)
+    || fused_size > (available - size * sizeof (instruction_t))
+      / sizeof (fused_t)
+    || available
+      != size * sizeof (instruction_t) + fused_size * sizeof (fused_t)
+    || checksum (data + sizeof header, data + file.size ()) != header.checksum)
+    fail ();
+
+  // program_t owns its instructions and ops, so it takes copies.
+  std::vector <instruction_t> instructions (size);
+  std::vector <fused_t> fused (fused_size);
+  std::memcpy (
+    instructions.data (), data + sizeof header, size * sizeof (instruction_t)
+  );
+  std::memcpy (
+    fused.data (), data + sizeof header + size * sizeof (instruction_t),
+    fused_size * sizeof (fused_t)
+  );
+
+  // Intact as the checksum says it is, but what running trusts is checked
+  // anyway: the jumps, that no op reaches before the first cell, and that
+  // none stands for more operations than there are instructions, which
+  // keeps the operation limit checks from wrapping around.
+  for (const fused_t &f : fused)
+  {
+    if (f.cost > size || ('>' != f.op && (f.arg < 0 || f.arg > 255)))
+      fail ();
+  }
+
+  for (size_t i = 0; i < size; ++i)
+  {
+    const instruction_t &instruction = instructions[i];
+    if (!instruction.op || !std::strchr ("+-<>.,[]", instruction.op)
+      || (('[' == instruction.op || ']' == instruction.op)
+        && (instruction.jump >= size
+          || instructions[instruction.jump].jump != i
+          || instructions[instruction.jump].op
+            != ('[' == instruction.op ? ']' : '['))))
+      fail ();
+  }
+
+  // Only the ops the top level steps through are dispatched on their own;
+  // the rest are run by the op before them.
+  std::vector <bool> stepped (fused_size);
+  for (size_t ip = 0; ip < fused_size; )
+  {
+    const fused_t &f = fused[ip];
+    stepped[ip] = true;
+    if (f.origin > size)
+      fail ();
+
+    if ('[' == f.op || ']' == f.op)
+    {
+      ++ip;
+      continue;
+    }
+
+    if (f.jump <= ip || f.jump > fused_size
+      || (REPEAT_OP == f.op
+        && (f.offset < 0 || size_t (f.offset) >= f.jump - ip)))
+      fail ();
+    ip = f.jump;
+  }
+  for (size_t ip = 0; ip < fused_size; ++ip)
+  {
+    const fused_t &f = fused[ip];
+    if (stepped[ip] && ('[' == f.op || ']' == f.op)
+      && (f.jump >= fused_size || !stepped[f.jump]
+        || fused[f.jump].jump != ip
+        || fused[f.jump].op != ('[' == f.op ? ']' : '[')))
+      fail ();
+  }
+
+  // How far the ops in [first, last) move the pointer, and the lowest cell
+  // they reach, relative to it. None can move it further than the program
+  // has instructions.
+  const ptrdiff_t most = size;
+  auto reach = [&] (size_t first, size_t last, ptrdiff_t *move,
+    ptrdiff_t *lowest) {
+    for (size_t ip = first; ip < last; ++ip)
+    {
+      const fused_t &f = fused[ip];
+      if (!f.op || !std::strchr ("+>.,", f.op)
+        || ('>' == f.op && (f.arg < -most || f.arg > most))
+        || f.offset < -most || f.offset > most)
+        fail ();
+
+      if ('>' == f.op)
+        *move += f.arg;
+      *lowest = std::min (*lowest, '>' == f.op ? *move : *move + f.offset);
+    }
+  };
+
+  // Whether no trip of each loop can leave the pointer lower, by the index
+  // of its '[', as ir_t finds it.
+  struct open_t
+  {
+    size_t ip;
+    ptrdiff_t move;
+    bool advancing;
+  };
+  std::vector <bool> advancing (fused_size);
+  std::vector <open_t> open;
+  for (size_t ip = 0; ip < fused_size; )
+  {
+    const fused_t &f = fused[ip];
+    if ('[' == f.op)
+    {
+      open.push_back ({ip, 0, true});
+      ++ip;
+      continue;
+    }
+    if (']' == f.op)
+    {
+      // Brackets matching each other may still cross.
+      if (open.empty () || open.back ().ip != f.jump)
+        fail ();
+      advancing[f.jump] = open.back ().advancing && open.back ().move >= 0;
+      open.pop_back ();
+      if (!open.empty ())
+        open.back ().advancing = open.back ().advancing && advancing[f.jump];
+      ++ip;
+      continue;
+    }
+
+    ptrdiff_t move = 0, lowest = 0;
+    if (REPEAT_OP != f.op && SCALE_OP != f.op)
+      reach (ip, f.jump, &move, &lowest);
+    if (!open.empty ())
+      open.back ().move += move;
+    ip = f.jump;
+  }
+
+  // Then the lowest cell each block or loop reaches, against the lowest the
+  // pointer can be at when it runs: what its check demands, or what came
+  // before leaves.
+  std::vector <size_t> floors;
+  size_t floor = 0;
+  for (size_t ip = 0; ip < fused_size; )
+  {
+    const fused_t &f = fused[ip];
+    if ('[' == f.op)
+    {
+      floors.push_back (floor);
+      floor = advancing[ip] ? floor : 0;
+      ++ip;
+      continue;
+    }
+    if (']' == f.op)
+    {
+      floor = std::min (floor, floors.back ());
+      floors.pop_back ();
+      ++ip;
+      continue;
+    }
+
+    if (f.low > 0 || f.low < -most)
+      fail ();
+    const size_t checked = std::max (floor, size_t (-f.low));
+    ptrdiff_t move = 0, lowest = 0;
+    if (REPEAT_OP == f.op || SCALE_OP == f.op)
+    {
+      // The body runs the ops up to the split on every trip, and must come
+      // back to the counter.
+      const size_t split = REPEAT_OP == f.op ? ip + 1 + f.offset : ip + 1;
+      reach (ip + 1, split, &move, &lowest);
+      if (move)
+        fail ();
+      reach (split, f.jump, &move, &lowest);
+      if (move)
+        fail ();
+    }
+    else
+    {
+      reach (ip, f.jump, &move, &lowest);
+      floor = checked + move;
+    }
+    if (ptrdiff_t (checked) < -lowest)
+      fail ();
+    ip = f.jump;
+  }
+
+  return std::unique_ptr <program_t> (
+    new program_t (instructions.data (), size, fused.data (), fused_size)
+  );
+}
+
+/// Compiles the program and writes it to options.compile, for a later run
+/// to load instead of compiling it again.
+static int
+run_compile (const options_t &options)
+{
+  try
+  {
+    std::string source;
+    read_file (options.program, &source);
+    const program_t program (begin (source), end (source));
+    write_artifact (options.compile, program);
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << options.program << ": " << e.what () << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
+
+/// Runs the program as a filter like run_stream (), recording the input it
+/// consumes and a checkpoint every CHECKPOINT_INTERVAL operations in
+/// options.record.
+static int
+run_record (const options_t &options)
+{
+  std::string source;
+  std::unique_ptr <program_t> program;
+  std::ofstream log;
+  try
+  {
+    read_file (options.program, &source);
+    program.reset (new program_t (begin (source), end (source)));
+    log.open (options.record, std::ios::out | std::ios::binary);
+    if (!log)
+      throw std::runtime_error ("unable to open " + options.record);
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << e.what () << std::endl;
+    return 1;
+  }
+
+  output_buffer_t output (STDOUT_FILENO);
+  input_buffer_t input (STDIN_FILENO, &output);
+  recorder_t recorder (&input, log);
+  std::ostream out (&output);
+  std::istream in (&recorder);
+  context_t c;
+  c.set_max_operations (operation_limit (options));
+  std::vector <size_t> entries;
+  program->fused_entries (&entries);
+  log.write (RECORDING_MAGIC, sizeof RECORDING_MAGIC - 1);
+  try
+  {
+    checkpoint_t checkpoint;
+    for (size_t ip = 0; ip < program->size (); )
+    {
+      if (c.operations ())
+      {
+        take_checkpoint (c, ip, recorder.consumed (), &checkpoint);
+        write_checkpoint (log, checkpoint);
+      }
+      ip = c.resume (
+        *program, entries, ip, in, out, c.operations () + CHECKPOINT_INTERVAL
+      );
+    }
+  }
+  catch (const std::exception &e)
+  {
+    out.flush ();
+    std::cerr << e.what () << std::endl;
+    return 1;
+  }
+
+  log.close ();
+  if (!log)
+  {
+    std::cerr << "unable to write " << options.record << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+/// Debugs the HackerRank style job in options.debug, reading commands from
+/// stdin.
+static int
+run_debugger (const options_t &options)
+{
+  job_t job;
+  std::unique_ptr <program_t> program;
+  try
+  {
+    std::string data;
+    read_file (options.debug, &data);
+    parse_job (data.data (), data.data () + data.size (), &job);
+    program.reset (new program_t (begin (job.code), end (job.code)));
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << options.debug << ": " << e.what () << std::endl;
+    return 1;
+  }
+
+  std::istringstream input (job.input);
+  debugger_t debugger (*program, job.code, options, input, std::cout);
+  debugger.run (std::cin, std::cout);
+  return 0;
+}
+
+/// Debugs a run recorded by run_record () in options.replay, on the input
+/// it consumed, reading commands from stdin.
+static int
+run_replay (const options_t &options)
+{
+  std::string source, recorded;
+  std::unique_ptr <program_t> program;
+  std::vector <checkpoint_t> checkpoints;
+  try
+  {
+    read_file (options.program, &source);
+    program.reset (new program_t (begin (source), end (source)));
+    read_recording (options.replay, *program, &recorded, &checkpoints);
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << e.what () << std::endl;
+    return 1;
+  }
+
+  const std::vector <char> code (begin (source), end (source));
+  std::istringstream input (recorded);
+  debugger_t debugger (
+    *program, code, options, input, std::cout, checkpoints
+  );
+  debugger.run (std::cin, std::cout);
+  return 0;
+}
+
+/// Runs the program as a filter from stdin to stdout. Input is read as the
+/// program consumes it and output written as buffers fill, or before waiting
+/// for input, so memory stays bounded whatever the length of the stream.
+static int
+run_stream (const options_t &options)
+{
+  std::unique_ptr <program_t> program;
+  try
+  {
+    program = load_program (options.program);
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << options.program << ": " << e.what () << std::endl;
+    return 1;
+  }
+
+  output_buffer_t output (STDOUT_FILENO);
+  input_buffer_t input (STDIN_FILENO, &output);
+  std::ostream out (&output);
+  std::istream in (&input);
+  context_t c;
+  c.set_max_operations (operation_limit (options));
+  try
+  {
+    (void) c.execute (*program, in, out);
+  }
+  catch (const std::exception &e)
+  {
+    out.flush ();
+    std::cerr << e.what () << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
+
+/// Compiles one program and runs it against many inputs in parallel. Results
+/// come out on stdout in input order, as a line of stats per input (name,
+/// status, operations, microseconds). Outputs either go to the output
+/// directory, or follow their stats line, whose last field is then their
+/// length, and are terminated by a newline. A prefix program runs once, and
+/// every input's run forks its final state.
+static int
+run_multi_input (const options_t &options)
+{
+  std::vector <input_t> inputs;
+  std::string prefix_source;
+  try
+  {
+    struct stat st;
+    if (0 == stat (options.inputs.c_str (), &st) && S_ISDIR (st.st_mode))
+      list_directory (options.inputs, &inputs);
+    else
+      list_archive (options.inputs, &inputs);
+
+    if (!options.prefix.empty ())
+      read_file (options.prefix, &prefix_source);
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << e.what () << std::endl;
+    return 1;
+  }
+
+  std::unique_ptr <program_t> program;
+  try
+  {
+    program = load_program (options.program);
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << options.program << ": " << e.what () << std::endl;
+    return 1;
+  }
+
+  context_t origin;
+  origin.set_max_operations (operation_limit (options));
+  std::ostringstream origin_output;
+  try
+  {
+    const program_t prefix (begin (prefix_source), end (prefix_source));
+    if (std::any_of (
+        prefix.begin (), prefix.end (),
+        [] (const instruction_t &i) { return ',' == i.op; }
+      ))
+    {
+      throw std::runtime_error ("the prefix can't read input");
+    }
+
+    std::istringstream none;
+    (void) origin.execute (prefix, none, origin_output);
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << options.prefix << ": " << e.what () << std::endl;
+    return 1;
+  }
+
+  const size_t jobs = std::max <size_t> (
+    1, std::min (jobs_wanted (options), inputs.size ())
+  );
+
+  // Workers publish results as they finish; this thread alone writes them,
+  // in order.
+  ordered_queue_t <result_t> results (4 * jobs);
+  std::atomic <size_t> next (0);
+  std::vector <std::thread> workers;
+  for (size_t i = 0; i < jobs; ++i)
+  {
+    workers.emplace_back (
+      run_inputs, std::cref (*program), std::cref (options), std::cref (origin),
+      origin_output.str (), &inputs, &results, &next
+    );
+  }
+
+  output_buffer_t buffer (STDOUT_FILENO);
+  std::ostream out (&buffer);
+  int status = 0;
+  for (size_t i = 0; i < inputs.size (); ++i)
+  {
+    const result_t result = results.take (i);
+    out << inputs[i].name << '\t' << result.status << '\t'
+      << result.operations << '\t' << result.elapsed.count ();
+    if (options.output_dir.empty ())
+    {
+      out << '\t' << result.output.size () << '\n';
+      out.write (result.output.data (), result.output.size ());
+    }
+    out << '\n';
+
+    if ("ok" != result.status)
+      status = 1;
+  }
+
+  for (auto &worker : workers)
+    worker.join ();
+
+  return status;
+}
+
+counters_t::counters_t ()
+{
+  static const std::pair <uint32_t, uint64_t> EVENTS[COUNTER_COUNT] =
+  {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {
+      PERF_TYPE_HW_CACHE,
+      PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8
+        | PERF_COUNT_HW_CACHE_RESULT_MISS << 16
+    },
+  };
+
+  for (int i = 0; i < COUNTER_COUNT; ++i)
+  {
+    perf_event_attr attr;
+    std::memset (&attr, 0, sizeof attr);
+    attr.size = sizeof attr;
+    attr.type = EVENTS[i].first;
+    attr.config = EVENTS[i].second;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.inherit = 1;
+    attr.read_format =
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    fds_[i] = syscall (SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    values_[i] = 0;
+  }
+}
+
+counters_t::~counters_t ()
+{
+  for (int fd : fds_)
+  {
+    if (fd >= 0)
+      close (fd);
+  }
+}
+
+void
+counters_t::start ()
+{
+  for (int fd : fds_)
+  {
+    if (fd >= 0)
+    {
+      ioctl (fd, PERF_EVENT_IOC_RESET, 0);
+      ioctl (fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+}
+
+void
+counters_t::stop ()
+{
+  for (int i = 0; i < COUNTER_COUNT; ++i)
+  {
+    if (fds_[i] < 0)
+      continue;
+
+    ioctl (fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+
+    // value, time enabled, time running
+    uint64_t data[3] = {0, 0, 0};
+    values_[i] = 0;
+    if (read (fds_[i], data, sizeof data) == sizeof data && data[2])
+      values_[i] = data[0] * (double (data[1]) / data[2]);
+  }
+}
+
+/// Writes @a text as a JSON string.
+static void
+write_json_string (std::ostream &out, const std::string &text)
+{
+  out << '"';
+  for (unsigned char c : text)
+  {
+    if ('"' == c || '\\' == c)
+      out << '\\' << c;
+    else if (c < 0x20)
+      out << "\\u" << std::hex << std::setw (4) << std::setfill ('0')
+        << unsigned (c) << std::dec << std::setfill (' ');
+    else
+      out << c;
+  }
+  out << '"';
+}
+
+static const char *const COUNTER_NAMES[counters_t::COUNTER_COUNT] =
+{
+  "cycles", "instructions", "branch_misses", "l1d_misses"
+};
+
+/// Writes @a results as a JSON array, one object per engine and workload.
+static void
+write_bench_json (
+  std::ostream &out, const std::vector <bench_result_t> &results )
+{
+  out << "[\n";
+  for (size_t i = 0; i < results.size (); ++i)
+  {
+    const auto &result = results[i];
+    out << "  {\"workload\": ";
+    write_json_string (out, result.workload);
+    out << ", \"engine\": ";
+    write_json_string (out, result.engine);
+    out << ", \"operations\": " << result.operations
+      << ", \"nanoseconds\": " << result.nanoseconds;
+    for (int k = 0; k < counters_t::COUNTER_COUNT; ++k)
+    {
+      if (result.counters[k] >= 0)
+      {
+        out << ", \"" << COUNTER_NAMES[k] << "\": "
+          << uint64_t (result.counters[k]);
+      }
+    }
+    out << (i + 1 < results.size () ? "},\n" : "}\n");
+  }
+  out << "]\n";
+}
+
+/// Reads results written by write_bench_json(): an array of flat objects
+/// holding strings and numbers. Unknown keys are ignored.
+/// @throw std::runtime_error if the JSON is malformed.
+static void
+read_bench_json (std::istream &in, std::vector <bench_result_t> *results)
+{
+  auto expect = [&] (char c) {
+    if (!(in >> std::ws) || in.get () != c)
+      throw std::runtime_error (std::string ("malformed JSON, expected ") + c);
+  };
+  auto next_is = [&] (char c) {
+    return in >> std::ws && in.peek () == c && (in.get (), true);
+  };
+  auto string = [&] () {
+    expect ('"');
+    std::string text;
+    for (int c; (c = in.get ()) != '"'; )
+    {
+      if (EOF == c)
+        throw std::runtime_error ("malformed JSON, unterminated string");
+      if ('\\' == c)
+      {
+        c = in.get ();
+        if ('u' == c)
+        {
+          char hex[5] = {};
+          in.read (hex, 4);
+          c = std::strtol (hex, nullptr, 16);
+        }
+        else if ('n' == c)
+        {
+          c = '\n';
+        }
+        else if ('t' == c)
+        {
+          c = '\t';
+        }
+      }
+      text.push_back (c);
+    }
+    return text;
+  };
+
+  expect ('[');
+  if (next_is (']'))
+    return;
+
+  do
+  {
+    bench_result_t result;
+    expect ('{');
+    if (!next_is ('}'))
+    {
+      do
+      {
+        const std::string key = string ();
+        expect (':');
+        in >> std::ws;
+        if ('"' == in.peek ())
+        {
+          const std::string text = string ();
+          if ("workload" == key)
+            result.workload = text;
+          else if ("engine" == key)
+            result.engine = text;
+          continue;
+        }
+
+        double number;
+        if (!(in >> number))
+          throw std::runtime_error ("malformed JSON, expected a value");
+        if ("operations" == key)
+          result.operations = number;
+        else if ("nanoseconds" == key)
+          result.nanoseconds = number;
+        for (int k = 0; k < counters_t::COUNTER_COUNT; ++k)
+        {
+          if (COUNTER_NAMES[k] == key)
+            result.counters[k] = number;
+        }
+      } while (next_is (','));
+      expect ('}');
+    }
+    results->push_back (std::move (result));
+  } while (next_is (','));
+  expect (']');
+}
+
+/// Reports every result more than @a threshold percent slower than its
+/// baseline.
+/// @return The number of regressions.
+static size_t
+compare_bench (
+  const std::vector <bench_result_t> &results,
+  const std::vector <bench_result_t> &baseline, double threshold )
+{
+  size_t regressions = 0;
+  for (const auto &result : results)
+  {
+    auto base = std::find_if (
+      begin (baseline), end (baseline), [&] (const bench_result_t &b) {
+        return b.workload == result.workload && b.engine == result.engine;
+      }
+    );
+    if (base == end (baseline))
+    {
+      std::cerr << result.workload << " " << result.engine
+        << ": no baseline" << std::endl;
+      continue;
+    }
+
+    const double change = base->nanoseconds
+      ? 100.0 * (double (result.nanoseconds) / base->nanoseconds - 1) : 0;
+    if (change > threshold)
+    {
+      std::cerr << result.workload << " " << result.engine << ": "
+        << std::fixed << std::setprecision (1) << change
+        << "% slower than baseline (" << base->nanoseconds << " ns -> "
+        << result.nanoseconds << " ns)" << std::endl;
+      ++regressions;
+    }
+  }
+
+  return regressions;
+}
+
+/// Times every selected engine on each job file named on the command line,
+/// printing the fastest of the repeated runs along with its hardware counters
+/// (IPC, and misses per BF operation). The results may be saved as JSON, and
+/// compared with earlier ones to catch slowdowns.
+static int
+run_bench (const options_t &options)
+{
+  std::vector <bench_result_t> baseline;
+  if (!options.baseline.empty ())
+  {
+    try
+    {
+      std::ifstream file (options.baseline);
+      if (!file)
+        throw std::runtime_error ("unable to open " + options.baseline);
+      read_bench_json (file, &baseline);
+    }
+    catch (const std::exception &e)
+    {
+      std::cerr << options.baseline << ": " << e.what () << std::endl;
+      return 1;
+    }
+  }
+
+  std::vector <const engine_t *> engines;
+  for (const auto &engine : ENGINES)
+  {
+    if (options.engines.empty () || options.engines.end () != std::find (
+      options.engines.begin (), options.engines.end (), engine.name))
+    {
+      engines.push_back (&engine);
+    }
+  }
+
+  counters_t counters;
+  if (!counters.available (counters_t::CYCLES))
+    std::cerr << "Hardware counters unavailable, timing only" << std::endl;
+
+  auto ratio = [] (std::ostream &out, bool ok, double n, double d) {
+    out << std::setw (12);
+    if (ok && d)
+      out << std::fixed << std::setprecision (3) << n / d;
+    else
+      out << '-';
+  };
+
+  std::cout << std::left << std::setw (24) << "workload" << std::setw (12)
+    << "engine" << std::right << std::setw (14) << "operations"
+    << std::setw (12) << "usec" << std::setw (12) << "ns/op"
+    << std::setw (12) << "IPC" << std::setw (12) << "br-miss/op"
+    << std::setw (12) << "L1d-miss/op" << '\n';
+
+  int status = 0;
+  std::vector <bench_result_t> results;
+  arena_t arena;
+  for (const auto &path : options.arguments)
+  {
+    job_t job;
+    std::unique_ptr <program_t> program;
+    std::unique_ptr <segment_plan_t> plan;
+    arena.reset ();
+    try
+    {
+      std::string data;
+      read_file (path, &data);
+      parse_job (data.data (), data.data () + data.size (), &job);
+      program.reset (
+        new program_t (begin (job.code), end (job.code), &arena)
+      );
+      plan.reset (new segment_plan_t (*program, &arena));
+    }
+    catch (const std::exception &e)
+    {
+      std::cerr << path << ": " << e.what () << std::endl;
+      status = 1;
+      continue;
+    }
+
+    for (const auto engine : engines)
+    {
+      std::cout << std::left << std::setw (24) << path << std::setw (12)
+        << engine->name << std::right;
+
+      size_t operations = 0;
+      auto best = std::chrono::nanoseconds::max ();
+      uint64_t values[counters_t::COUNTER_COUNT] = {};
+      try
+      {
+        for (size_t i = 0; i < options.repeat; ++i)
+        {
+          context_t c;
+          c.set_max_operations (operation_limit (options));
+          std::istringstream input (job.input);
+          std::ostringstream out;
+
+          const auto start = std::chrono::steady_clock::now ();
+          counters.start ();
+          operations = engine->execute (
+            c, *program, *plan, input, out, jobs_wanted (options)
+          );
+          counters.stop ();
+          const auto elapsed = std::chrono::steady_clock::now () - start;
+
+          if (elapsed < best)
+          {
+            best = elapsed;
+            for (int k = 0; k < counters_t::COUNTER_COUNT; ++k)
+              values[k] = counters.value (counters_t::counter_t (k));
+          }
+        }
+      }
+      catch (const std::exception &e)
+      {
+        std::cout << "  error: " << e.what () << std::endl;
+        status = 1;
+        continue;
+      }
+
+      std::cout << std::setw (14) << operations << std::setw (12)
+        << best.count () / 1000;
+      ratio (std::cout, true, best.count (), operations);
+      ratio (
+        std::cout, counters.available (counters_t::INSTRUCTIONS)
+          && counters.available (counters_t::CYCLES),
+        values[counters_t::INSTRUCTIONS], values[counters_t::CYCLES]
+      );
+      ratio (
+        std::cout, counters.available (counters_t::BRANCH_MISSES),
+        values[counters_t::BRANCH_MISSES], operations
+      );
+      ratio (
+        std::cout, counters.available (counters_t::L1D_MISSES),
+        values[counters_t::L1D_MISSES], operations
+      );
+      std::cout << std::endl;
+
+      bench_result_t result;
+      result.workload = path;
+      result.engine = engine->name;
+      result.operations = operations;
+      result.nanoseconds = best.count ();
+      for (int k = 0; k < counters_t::COUNTER_COUNT; ++k)
+      {
+        if (counters.available (counters_t::counter_t (k)))
+          result.counters[k] = values[k];
+      }
+      results.push_back (std::move (result));
+    }
+  }
+
+  if (!options.json.empty ())
+  {
+    std::ofstream file (options.json);
+    write_bench_json (file, results);
+    if (!file)
+    {
+      std::cerr << "Unable to write " << options.json << std::endl;
+      status = 1;
+    }
+  }
+
+  if (!options.baseline.empty ()
+    && compare_bench (results, baseline, options.threshold) && !status)
+  {
+    status = 2;
+  }
+
+  return status;
+}
+
+/// Times parse_job () against the stream based read_job () it replaced, on a
+/// generated job with options.bench_parse code lines.
+/// @return The exit status.
+static int
+run_parse_bench (const options_t &options)
+{
+  std::string data;
+  {
+    const std::string input (1000, ',');
+    std::ostringstream job;
+    job << input.size () << ' ' << options.bench_parse << '\n' << input
+      << "$\n";
+    for (size_t i = 0; i < options.bench_parse; ++i)
+      job << "++++[>++++++++<-]>+.  print an exclamation mark" << '\n';
+    data = job.str ();
+  }
+
+  std::cout << std::left << std::setw (12) << "parser" << std::right
+    << std::setw (12) << "lines" << std::setw (14) << "bytes"
+    << std::setw (12) << "usec" << std::setw (12) << "MB/s" << '\n';
+
+  auto time = [&] (const char *name, std::function <void (job_t *)> parse) {
+    job_t job;
+    auto best = std::chrono::nanoseconds::max ();
+    for (size_t i = 0; i < options.repeat; ++i)
+    {
+      const auto start = std::chrono::steady_clock::now ();
+      parse (&job);
+      best = std::min <std::chrono::nanoseconds> (
+        best, std::chrono::steady_clock::now () - start
+      );
+    }
+
+    std::cout << std::left << std::setw (12) << name << std::right
+      << std::setw (12) << options.bench_parse << std::setw (14)
+      << data.size () << std::setw (12) << best.count () / 1000
+      << std::setw (12) << std::fixed << std::setprecision (1)
+      << 1e3 * data.size () / best.count () << std::endl;
+    return job;
+  };
+
+  try
+  {
+    const job_t reference = time ("istream", [&] (job_t *job) {
+      std::istringstream in (data);
+      read_job (in, job);
+    });
+    const job_t job = time ("buffer", [&] (job_t *job) {
+      parse_job (data.data (), data.data () + data.size (), job);
+    });
+
+    if (job.input != reference.input || job.code != reference.code)
+      throw std::runtime_error ("parsers disagree");
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << e.what () << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
+
+int
+main (int argc, char **argv)
+{
+  options_t options;
+  if (!parse_options (argc, argv, &options))
+    return 1;
+
+  switch (options.mode)
+  {
+  case INPUTS_MODE: return run_multi_input (options);
+  case BENCH_MODE: return run_bench (options);
+  case BENCH_PARSE_MODE: return run_parse_bench (options);
+  case SERVE_MODE: return run_server (options);
+  case DEBUG_MODE: return run_debugger (options);
+  case RECORD_MODE: return run_record (options);
+  case REPLAY_MODE: return run_replay (options);
+  case COMPILE_MODE: return run_compile (options);
+  case STREAM_MODE: return run_stream (options);
+  case JOB_MODE:
+  case ESTIMATE_MODE:
+  case PROFILE_MODE:
+  case TRIPS_MODE:
+    break;
+  }
+
+  job_t job;
+  std::unique_ptr <program_t> program;
+  try
+  {
+    std::string data;
+    read_all (STDIN_FILENO, &data);
+    parse_job (data.data (), data.data () + data.size (), &job);
+    program.reset (new program_t (begin (job.code), end (job.code)));
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << e.what () << std::endl;
+    return 1;
+  }
+
+  if (ESTIMATE_MODE == options.mode)
+  {
+    const cost_estimate_t estimate (*program);
+    auto bound = [] (size_t n) {
+      return cost_estimate_t::UNBOUNDED == n
+        ? std::string ("unbounded") : std::to_string (n);
+    };
+    std::cout << "operations: " << bound (estimate.operations ()) << '\n'
+      << "tape: " << bound (estimate.tape ()) << std::endl;
+    return 0;
+  }
+
+  output_buffer_t buffer (STDOUT_FILENO);
+  std::ostream out (&buffer);
+  std::istringstream input (job.input);
+  context_t c;
+  c.set_max_operations (operation_limit (options));
+  if (options.segments)
+  {
+    const segment_plan_t plan (*program);
+    (void) c.execute (*program, plan, input, out, jobs_wanted (options));
+  }
+  else if (PROFILE_MODE == options.mode)
+  {
+    std::ofstream profile (options.profile);
+    if (!profile)
+    {
+      std::cerr << "Unable to open " << options.profile << std::endl;
+      return 1;
+    }
+
+    // A run that fails, say on the operation limit, is profiled up to there.
+    sampler_t sampler;
+    std::string error;
+    sampler.start (std::chrono::microseconds (options.profile_interval));
+    try
+    {
+      (void) c.execute (*program, input, out, sampler);
+    }
+    catch (const std::exception &e)
+    {
+      error = e.what ();
+    }
+    sampler.stop ();
+
+    sampler.report (*program, profile);
+    if (sampler.dropped ())
+    {
+      std::cerr << "Profile buffer full, dropped " << sampler.dropped ()
+        << " samples" << std::endl;
+    }
+    if (!error.empty ())
+    {
+      out.flush ();
+      std::cerr << error << std::endl;
+      return 1;
+    }
+  }
+  else if (TRIPS_MODE == options.mode)
+  {
+    std::ofstream trips (options.trips);
+    if (!trips)
+    {
+      std::cerr << "Unable to open " << options.trips << std::endl;
+      return 1;
+    }
+
+    // As with --profile, a run that fails is reported up to there.
+    trip_counter_t counter (*program);
+    std::string error;
+    try
+    {
+      (void) c.execute (*program, input, out, counter);
+    }
+    catch (const std::exception &e)
+    {
+      error = e.what ();
+    }
+
+    counter.report (trips);
+    if (!error.empty ())
+    {
+      out.flush ();
+      std::cerr << error << std::endl;
+      return 1;
+    }
+  }
+  else
+  {
+    (void) c.execute (*program, input, out);
+  }
 
-  std::cout << std::endl;
+  out << std::endl;
   return 0;
 }
 
 } // namespace brainfck
 
+// Tests include this file and bring their own main ().
+#ifndef BRAINFCK_NO_MAIN
 int
-main ()
+main (int argc, char **argv)
 {
-  return brainfck::main ();
+  return brainfck::main (argc, argv);
 }
+#endif
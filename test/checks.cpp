@@ -0,0 +1,298 @@
+// Deterministic checks of the parts the fuzz test doesn't reach: compiled
+// programs, the job parser, copy-on-write tapes and the ordered queue.
+//
+//   checks
+//
+// Prints each failed check, and exits with status 1 if there was any.
+
+#define BRAINFCK_NO_MAIN
+#include "../src/brainfck.cpp"
+
+#include <random>
+
+namespace
+{
+
+using namespace brainfck;
+
+size_t failures = 0;
+
+/// Reports @a what as failed unless @a ok.
+void
+check (bool ok, const std::string &what)
+{
+  if (!ok)
+  {
+    std::cout << "FAILED: " << what << std::endl;
+    ++failures;
+  }
+}
+
+/// @return The output and operation count of running @a program on
+/// @a input, or the error it ran into.
+std::string
+run (const program_t &program, const std::string &input)
+{
+  context_t c;
+  std::istringstream in (input);
+  std::ostringstream out;
+  try
+  {
+    (void) c.execute (program, in, out);
+  }
+  catch (const std::exception &e)
+  {
+    return std::string ("error: ") + e.what ();
+  }
+  return out.str () + " in " + std::to_string (c.operations ());
+}
+
+/// @return The error loading the program at @a path throws, or an empty
+/// string if it loads.
+std::string
+load_error (const std::string &path)
+{
+  try
+  {
+    (void) load_program (path);
+  }
+  catch (const std::exception &e)
+  {
+    return e.what ();
+  }
+  return std::string ();
+}
+
+void
+write_file (const std::string &path, const std::string &data)
+{
+  std::ofstream file (path, std::ios::out | std::ios::binary);
+  file << data;
+}
+
+/// A program written with --compile loads as it was, and runs the same;
+/// one that is stale, damaged or cut short is rejected.
+void
+check_artifacts ()
+{
+  static const char HELLO[] =
+    "++++++++[>++++[>++>+++>+++>+<<<<-]>+>+>->>+[<]<-]>>.>---.+++++++..+++."
+    ">>.<-.<.+++.------.--------.>>+.>++.,[.,]";
+  const std::string path =
+    "/tmp/brainfck-checks-" + std::to_string (getpid ()) + ".bfc";
+  const program_t program (std::begin (HELLO), std::end (HELLO) - 1);
+  write_artifact (path, program);
+
+  std::unique_ptr <program_t> loaded;
+  try
+  {
+    loaded = load_program (path);
+  }
+  catch (const std::exception &e)
+  {
+    check (false, std::string ("loading a compiled program: ") + e.what ());
+  }
+  if (loaded)
+  {
+    check (
+      loaded->size () == program.size () && std::equal (
+        program.begin (), program.end (), loaded->begin (),
+        [] (const instruction_t &a, const instruction_t &b) {
+          return a.op == b.op && a.jump == b.jump && a.position == b.position;
+        }
+      ),
+      "compiled instructions load as written"
+    );
+    check (
+      loaded->fused ().size () == program.fused ().size () && std::equal (
+        program.fused ().begin (), program.fused ().end (),
+        loaded->fused ().begin (),
+        [] (const fused_t &a, const fused_t &b) {
+          return a.op == b.op && a.arg == b.arg && a.offset == b.offset
+            && a.jump == b.jump && a.cost == b.cost && a.origin == b.origin
+            && a.low == b.low;
+        }
+      ),
+      "compiled ops load as written"
+    );
+    check (
+      run (*loaded, "echo") == run (program, "echo"),
+      "a compiled program runs as its source does"
+    );
+  }
+
+  std::string data;
+  read_file (path, &data);
+
+  std::string stale = data;
+  artifact_header_t header;
+  std::memcpy (&header, stale.data (), sizeof header);
+  ++header.version;
+  std::memcpy (&stale[0], &header, sizeof header);
+  write_file (path, stale);
+  check (
+    "compiled by another version" == load_error (path),
+    "a program compiled by another version is rejected"
+  );
+
+  std::string damaged = data;
+  damaged[damaged.size () - 1] ^= 1;
+  write_file (path, damaged);
+  check (
+    "corrupt compiled program" == load_error (path),
+    "a damaged compiled program is rejected"
+  );
+
+  write_file (path, data.substr (0, data.size () - 5));
+  check (
+    "corrupt compiled program" == load_error (path),
+    "a truncated compiled program is rejected"
+  );
+
+  unlink (path.c_str ());
+}
+
+/// parse_job () accepts and rejects what read_job () does, with the same
+/// input, code and errors: on a few typical jobs, then on random ones.
+void
+check_parser ()
+{
+  std::vector <std::string> jobs = {
+    "3 2\nabc$\n+.\n,.\n",
+    "0 1\n$\n++[>+<-]>.\n",
+    "2 1\r\nab$\r\n+.\r\n",
+    "  1   1  \n\nx$\n\n,.",
+    "4 1\nabc$\n+\n",
+    "0 3\n$\n+\n-\n",
+    "-1 1\n$\n+\n",
+    "18446744073709551616 1\n$\n+\n",
+    "1 1\n$$\n.\n",
+    "x",
+    "",
+  };
+  std::mt19937 random (1);
+  for (int i = 0; i < 2000; ++i)
+  {
+    std::string job;
+    for (int n = random () % 24; n; --n)
+      job += " 0123456789$\n\r-+x."[random () % 19];
+    jobs.push_back (job);
+  }
+
+  for (const auto &data : jobs)
+  {
+    job_t expected, actual;
+    std::string expected_error, actual_error;
+    try
+    {
+      std::istringstream in (data);
+      read_job (in, &expected);
+    }
+    catch (const std::exception &e)
+    {
+      expected_error = e.what ();
+    }
+    try
+    {
+      parse_job (data.data (), data.data () + data.size (), &actual);
+    }
+    catch (const std::exception &e)
+    {
+      actual_error = e.what ();
+    }
+
+    check (
+      expected_error == actual_error && (!expected_error.empty ()
+        || (expected.input == actual.input && expected.code == actual.code)),
+      "parse_job () agrees with read_job () on \"" + data + "\""
+    );
+  }
+}
+
+/// Clones of a context, as --prefix makes for each input, share its tape
+/// without seeing each other's changes, or its own.
+void
+check_clones ()
+{
+  // Cells over a few pages, so the clones change some pages and share others.
+  std::string cells (3 * tape_t::PAGE_SIZE, '\0');
+  for (size_t slot = 0; slot < cells.size (); ++slot)
+    cells[slot] = char (slot % 251 + 1);
+  context_t origin;
+  origin.restore (cells, 0, 7);
+
+  const size_t far = tape_t::PAGE_SIZE + 10;
+  const std::string code = std::string (far, '>') + "+++";
+  const program_t program (code.begin (), code.end ());
+  context_t a, b;
+  origin.clone (&a);
+  origin.clone (&b);
+  check (a.operations () == 7, "a clone keeps the operation count");
+
+  std::istringstream in;
+  std::ostringstream out;
+  (void) a.execute (program, in, out);
+  check (
+    a.cell (far) == (unsigned char) (cells[far] + 3),
+    "a clone changes its own copy of a page"
+  );
+  check (
+    origin.cell (far) == (unsigned char) cells[far]
+      && b.cell (far) == (unsigned char) cells[far],
+    "a clone's change is seen by neither the original nor other clones"
+  );
+
+  (void) origin.execute (program, in, out);
+  check (
+    b.cell (far) == (unsigned char) cells[far]
+      && a.cell (far) == (unsigned char) (cells[far] + 3),
+    "the original's later changes aren't seen by its clones"
+  );
+
+  bool same = true;
+  for (size_t slot = 0; slot < cells.size (); ++slot)
+  {
+    if (slot != far)
+      same = same && b.cell (slot) == (unsigned char) cells[slot];
+  }
+  check (same, "a clone has the original's tape");
+}
+
+/// Values published by several producers, out of order and through fewer
+/// slots than values, are taken in sequence.
+void
+check_queue ()
+{
+  const size_t count = 5000;
+  ordered_queue_t <std::string> queue (3);
+  std::atomic <size_t> next (0);
+  std::vector <std::thread> producers;
+  for (int t = 0; t < 4; ++t)
+  {
+    producers.emplace_back ([&] {
+      for (size_t i; (i = next++) < count; )
+        queue.publish (i, std::to_string (i));
+    });
+  }
+
+  bool ordered = true;
+  for (size_t i = 0; i < count; ++i)
+    ordered = ordered && queue.take (i) == std::to_string (i);
+  for (auto &producer : producers)
+    producer.join ();
+  check (ordered, "the ordered queue hands values over in sequence");
+}
+
+} // anonymous namespace
+
+int
+main ()
+{
+  check_artifacts ();
+  check_parser ();
+  check_clones ();
+  check_queue ();
+
+  std::cout << (failures ? "checks failed" : "checks passed") << std::endl;
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,224 @@
+// Differential fuzz test: runs random programs on every engine and on a naive
+// interpreter of the source, and checks that they agree on the error, output,
+// operation count, pointer position and tape.
+//
+//   fuzz [SEED [PROGRAMS]]
+//
+// Exits with status 1, after printing the first few disagreements, if any.
+
+#define BRAINFCK_NO_MAIN
+#include "../src/brainfck.cpp"
+
+#include <random>
+
+namespace
+{
+
+using namespace brainfck;
+
+/// What a run of a program leaves behind.
+struct outcome_t
+{
+  /// The exception's message, if the run threw one.
+  std::string error;
+
+  std::string output;
+  size_t operations = 0;
+  size_t position = 0;
+  std::vector <unsigned char> tape;
+};
+
+/// Generates a random program of nested loops up to @a depth deep, mostly
+/// counter style ones the optimizer fuses.
+std::string
+generate (std::mt19937 &random, int depth)
+{
+  std::string code;
+  for (int i = random () % 12; i; --i)
+  {
+    const int kind = random () % 20;
+    if (kind < 6)
+      code += std::string (random () % 5 + 1, "+-"[random () % 2]);
+    else if (kind < 10)
+      code += std::string (random () % 3 + 1, "<>"[random () % 2]);
+    else if (kind < 12)
+      code += '.';
+    else if (kind < 13)
+      code += ',';
+    else if (kind < 17 && depth < 3)
+    {
+      const std::string body = generate (random, depth + 1);
+      switch (random () % 3)
+      {
+      case 0:
+        code += "[" + body + "]";
+        break;
+      case 1:
+        code += "[-" + std::string (random () % 2, '>') + body
+          + std::string (random () % 2, '<') + "]";
+        break;
+      default:
+        code += std::string (random () % 9, '+') + "[>"
+          + (random () % 2 ? body : std::string ()) + "<"
+          + std::string (random () % 3 ? 1 : 3, '-') + "]";
+        break;
+      }
+    }
+  }
+  return code;
+}
+
+/// Runs @a code, whose brackets match, on @a input one command at a time,
+/// straight from the source, as the specification the engines are held to.
+outcome_t
+interpret (
+  const std::string &code, const std::string &input, size_t max_operations )
+{
+  std::vector <size_t> jump (code.size ());
+  std::vector <size_t> open;
+  for (size_t ip = 0; ip < code.size (); ++ip)
+  {
+    if ('[' == code[ip])
+      open.push_back (ip);
+    else if (']' == code[ip])
+    {
+      jump[ip] = open.back ();
+      jump[open.back ()] = ip;
+      open.pop_back ();
+    }
+  }
+
+  outcome_t outcome;
+  outcome.tape.assign (1, 0);
+  size_t next_input = 0;
+  for (size_t ip = 0; ip < code.size (); ++ip)
+  {
+    if (outcome.operations == max_operations)
+    {
+      outcome.error = "max operations exceeded";
+      break;
+    }
+    ++outcome.operations;
+
+    unsigned char &cell = outcome.tape[outcome.position];
+    switch (code[ip])
+    {
+    case '+': ++cell; break;
+    case '-': --cell; break;
+    case '.': outcome.output += char (cell); break;
+    case '[': if (!cell) ip = jump[ip]; break;
+    case ']': if (cell) ip = jump[ip]; break;
+    case ',':
+      if (next_input < input.size ())
+        cell = input[next_input++];
+      break;
+    case '>':
+      if (++outcome.position == outcome.tape.size ())
+        outcome.tape.push_back (0);
+      break;
+    case '<':
+      if (!outcome.position)
+      {
+        outcome.error = "slot underflow";
+        return outcome;
+      }
+      --outcome.position;
+      break;
+    }
+  }
+  return outcome;
+}
+
+/// Runs @a program on @a input with @a engine.
+outcome_t
+run_engine (
+  const engine_t &engine, const program_t &program, const segment_plan_t &plan,
+  const std::string &input, size_t max_operations, size_t tape_size )
+{
+  outcome_t outcome;
+  context_t c;
+  c.set_max_operations (max_operations);
+  std::istringstream in (input);
+  std::ostringstream out;
+  try
+  {
+    engine.execute (c, program, plan, in, out, 4);
+  }
+  catch (const std::exception &e)
+  {
+    outcome.error = e.what ();
+  }
+  outcome.output = out.str ();
+  outcome.operations = c.operations ();
+  outcome.position = c.position ();
+  for (size_t slot = 0; slot < tape_size; ++slot)
+    outcome.tape.push_back (c.cell (slot));
+  return outcome;
+}
+
+/// @return What differs between @a a and @a b, or an empty string.
+std::string
+compare (const outcome_t &a, const outcome_t &b)
+{
+  if (a.error != b.error)
+    return "error '" + a.error + "' vs '" + b.error + "'";
+  if (a.output != b.output)
+    return "output";
+  if (a.operations != b.operations)
+    return "operations " + std::to_string (a.operations) + " vs "
+      + std::to_string (b.operations);
+  if (a.position != b.position)
+    return "position " + std::to_string (a.position) + " vs "
+      + std::to_string (b.position);
+  for (size_t slot = 0; slot < a.tape.size (); ++slot)
+  {
+    if (a.tape[slot] != b.tape[slot])
+      return "slot " + std::to_string (slot);
+  }
+  return std::string ();
+}
+
+} // anonymous namespace
+
+int
+main (int argc, char **argv)
+{
+  std::mt19937 random (argc > 1 ? std::strtoul (argv[1], nullptr, 10) : 1);
+  const size_t count = argc > 2 ? std::strtoul (argv[2], nullptr, 10) : 20000;
+
+  size_t mismatches = 0;
+  for (size_t i = 0; i < count; ++i)
+  {
+    // A leading move keeps most programs from underflowing at once; those
+    // without input can be split into segments.
+    std::string code = generate (random, 0);
+    if (random () % 4)
+      code = ">>" + code;
+    if (random () % 4 == 0)
+      code.erase (std::remove (code.begin (), code.end (), ','), code.end ());
+
+    std::string input;
+    for (int n = random () % 6; n; --n)
+      input += char (random ());
+    const size_t max_operations = random () % 2 ? 100000 : random () % 3000;
+
+    const outcome_t expected = interpret (code, input, max_operations);
+    const program_t program (code.begin (), code.end ());
+    const segment_plan_t plan (program);
+    for (const auto &engine : ENGINES)
+    {
+      const std::string difference = compare (expected, run_engine (
+        engine, program, plan, input, max_operations, expected.tape.size ()
+      ));
+      if (!difference.empty () && mismatches++ < 5)
+      {
+        std::cout << engine.name << ": " << difference << " running " << code
+          << " (limit " << max_operations << ", " << input.size ()
+          << " bytes of input)\n";
+      }
+    }
+  }
+
+  std::cout << count << " programs, " << mismatches << " mismatches\n";
+  return mismatches ? 1 : 0;
+}